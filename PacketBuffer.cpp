@@ -0,0 +1,34 @@
+#include "PacketBuffer.h"
+
+#include <cassert>
+
+PacketBuffer::PacketBuffer(const PacketProcessor& processor, size_t capacity) : processor_(processor) {
+  payload(capacity);
+}
+
+uint8_t* PacketBuffer::payload(size_t capacity) {
+  const size_t need = PacketProcessor::HEADROOM + capacity + PacketProcessor::TAILROOM;
+  if (buffer_.size() < need) buffer_.resize(need);
+  return payload();
+}
+
+uint8_t* PacketBuffer::payload() {
+  return buffer_.data() + PacketProcessor::HEADROOM;
+}
+
+size_t PacketBuffer::capacity() const {
+  return buffer_.size() - PacketProcessor::HEADROOM - PacketProcessor::TAILROOM;
+}
+
+void PacketBuffer::finalize(uint32_t size) {
+  assert(size <= capacity());
+  frame_ = processor_.packInPlace(buffer_.data(), size, &frameSize_);
+}
+
+const uint8_t* PacketBuffer::data() const {
+  return frame_;
+}
+
+size_t PacketBuffer::size() const {
+  return frameSize_;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "PacketProcessor.h"
+
+/**
+ * 原地打包缓存: 预留包头和校验的空间 序列化直接写入payload() 再调用finalize填充包头和校验
+ * 得到的数据包可直接发送 无需再次拷贝 缓存可重复使用
+ */
+class PacketBuffer {
+ public:
+  explicit PacketBuffer(const PacketProcessor& processor, size_t capacity = 0);
+
+ public:
+  /**
+   * 确保可写入capacity字节数据
+   * @return 数据写入位置
+   */
+  uint8_t* payload(size_t capacity);
+
+  uint8_t* payload();
+
+  /**
+   * @return 可写入的数据字节数
+   */
+  size_t capacity() const;
+
+  /**
+   * 填充包头和校验
+   * @param size 已写入的数据字节数 不可超过capacity()
+   */
+  void finalize(uint32_t size);
+
+  /**
+   * @return 数据包 finalize之后有效
+   */
+  const uint8_t* data() const;
+
+  size_t size() const;
+
+ private:
+  const PacketProcessor& processor_;
+  std::vector<uint8_t> buffer_;
+  const uint8_t* frame_ = nullptr;
+  size_t frameSize_ = 0;
+};
@@ -0,0 +1,113 @@
+#include "PacketCrcPool.h"
+
+#include <algorithm>
+
+#include "crc/checksum.h"
+
+// #define PacketProcessor_LOG_SHOW_VERBOSE
+#include "log.h"
+
+PacketCrcPool& PacketCrcPool::instance() {
+  static PacketCrcPool pool;
+  return pool;
+}
+
+PacketCrcPool::PacketCrcPool(size_t threads)
+    : threadCount_(threads ? threads : std::max<size_t>(1, std::thread::hardware_concurrency())), results_(threadCount_) {}
+
+PacketCrcPool::~PacketCrcPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+  cv_.notify_all();
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+size_t PacketCrcPool::threadCount() const {
+  return threadCount_;
+}
+
+uint16_t PacketCrcPool::crc16(const uint8_t* data, size_t size) {
+  const size_t chunks = std::min(threadCount_, size / MIN_CHUNK_SIZE);
+  if (chunks <= 1) return crc_16(data, size);
+
+  std::unique_lock<std::mutex> job(jobMutex_, std::try_to_lock);
+  if (not job.owns_lock()) {
+    PacketProcessor_LOGV("crc pool busy, size: %zu", size);
+    return crc_16(data, size);
+  }
+
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (threads_.empty()) {
+      for (size_t i = 1; i < threadCount_; i++) {
+        threads_.emplace_back(&PacketCrcPool::workerLoop, this);
+      }
+    }
+    data_ = data;
+    size_ = size;
+    chunkSize_ = (size + chunks - 1) / chunks;
+    chunks_ = chunks;
+    next_ = 0;
+    remaining_ = chunks;
+    generation = ++generation_;
+  }
+  cv_.notify_all();
+
+  runChunks(generation);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    doneCv_.wait(lock, [&] {
+      return remaining_ == 0;
+    });
+  }
+
+  uint16_t crc = results_[0];
+  for (size_t i = 1; i < chunks; i++) {
+    const size_t len = std::min(chunkSize_, size - i * chunkSize_);
+    crc = crc_16_combine(crc, results_[i], len);
+  }
+  return crc;
+}
+
+void PacketCrcPool::workerLoop() {
+  uint64_t seen = 0;
+  for (;;) {
+    uint64_t generation;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [&] {
+        return not running_ || generation_ != seen;
+      });
+      if (not running_) return;
+      generation = seen = generation_;
+    }
+    runChunks(generation);
+  }
+}
+
+void PacketCrcPool::runChunks(uint64_t generation) {
+  for (;;) {
+    const uint8_t* data;
+    size_t len;
+    size_t index;
+    {
+      // 按任务序号领取 避免迟到的线程计算下一个任务的分段
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (generation != generation_ || next_ >= chunks_) return;
+      index = next_++;
+      data = data_ + index * chunkSize_;
+      len = std::min(chunkSize_, size_ - index * chunkSize_);
+    }
+
+    const uint16_t crc = crc_16(data, len);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    results_[index] = crc;
+    if (--remaining_ == 0) doneCv_.notify_one();
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * 并行计算CRC16的线程池
+ * 数据切分为多段由调用线程和工作线程分别计算 再用crc_16_combine合并 结果与crc_16逐位相同
+ * 工作线程在第一次计算时创建 同一时刻只执行一个任务 池忙时调用者直接串行计算
+ */
+class PacketCrcPool {
+ public:
+  static const size_t MIN_CHUNK_SIZE = 256 * 1024;  // 每段最少字节数 更小时不值得切分
+
+ public:
+  /**
+   * 进程内共享的线程池 线程数为CPU核数
+   */
+  static PacketCrcPool& instance();
+
+  /**
+   * @param threads 参与计算的线程数(包括调用线程) 为0时使用CPU核数
+   */
+  explicit PacketCrcPool(size_t threads = 0);
+
+  ~PacketCrcPool();
+
+  PacketCrcPool(const PacketCrcPool&) = delete;
+  PacketCrcPool& operator=(const PacketCrcPool&) = delete;
+
+ public:
+  uint16_t crc16(const uint8_t* data, size_t size);
+
+  size_t threadCount() const;
+
+ private:
+  void workerLoop();
+
+  /**
+   * 领取并计算当前任务的分段 直到没有剩余分段
+   */
+  void runChunks(uint64_t generation);
+
+ private:
+  const size_t threadCount_;
+  std::vector<std::thread> threads_;
+  std::mutex jobMutex_;  // 同一时刻只执行一个任务
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable doneCv_;
+  bool running_ = true;
+  uint64_t generation_ = 0;  // 任务序号 工作线程据此判断是否有新任务
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  size_t chunkSize_ = 0;
+  size_t chunks_ = 0;
+  size_t next_ = 0;       // 下一个待领取的分段
+  size_t remaining_ = 0;  // 未完成的分段数
+  std::vector<uint16_t> results_;
+};
@@ -0,0 +1,271 @@
+#include "PacketEngine.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <utility>
+
+// #define PacketProcessor_LOG_SHOW_VERBOSE
+#include "log.h"
+
+struct PacketEngine::Connection {
+  std::unique_ptr<PacketProcessor> processor;
+  size_t home;                // 所属分片
+  std::atomic<size_t> shard;  // 当前处理的分片 被窃取后为窃取者 积压处理完后恢复为home
+
+  std::mutex mutex;
+  std::vector<uint8_t> pending;  // 待处理数据 由mutex保护
+  std::vector<uint8_t> working;  // 正在处理的数据 仅由处理线程访问
+  bool scheduled = false;        // 已排队或正在处理 由mutex保护
+  bool closed = false;           // 已移除 由mutex保护
+};
+
+struct PacketEngine::Shard {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Connection*> queue;
+  std::thread thread;
+  std::atomic<bool> idle{false};  // 线程正在等待
+  bool wake = false;              // 有其他分片繁忙 由mutex保护
+
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> batches{0};
+  std::atomic<uint64_t> steals{0};
+  std::atomic<uint64_t> stolen{0};
+  std::atomic<uint64_t> busyUs{0};
+};
+
+// 空闲线程尝试窃取的间隔 持续空闲时指数退避 繁忙分片会主动唤醒
+static const auto STEAL_INTERVAL_MIN = std::chrono::milliseconds(1);
+static const auto STEAL_INTERVAL_MAX = std::chrono::milliseconds(128);
+
+PacketEngine::PacketEngine(size_t threads) {
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+
+  for (size_t i = 0; i < threads; i++) {
+    shards_.emplace_back(new Shard);
+  }
+  for (size_t i = 0; i < threads; i++) {
+    shards_[i]->thread = std::thread(&PacketEngine::workerLoop, this, i);
+  }
+}
+
+PacketEngine::~PacketEngine() {
+  wait();
+  running_ = false;
+  for (auto& shard : shards_) {
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+    }
+    shard->cv.notify_all();
+  }
+  for (auto& shard : shards_) {
+    shard->thread.join();
+  }
+  for (auto c : connections_) {
+    delete c;
+  }
+}
+
+PacketEngine::Connection* PacketEngine::addConnection(std::unique_ptr<PacketProcessor> processor) {
+  auto c = new Connection;
+  c->processor = std::move(processor);
+  c->home = nextShard_++ % shards_.size();
+  c->shard = c->home;
+
+  std::lock_guard<std::mutex> lock(connectionsMutex_);
+  connections_.insert(c);
+  return c;
+}
+
+void PacketEngine::removeConnection(Connection* c) {
+  {
+    std::lock_guard<std::mutex> lock(c->mutex);
+    c->closed = true;
+    // 正在处理 由处理线程释放
+    if (c->scheduled) return;
+  }
+  destroyConnection(c);
+}
+
+void PacketEngine::feed(Connection* c, const void* data, size_t size) {
+  if (size == 0) return;
+  {
+    std::lock_guard<std::mutex> lock(c->mutex);
+    assert(!c->closed);
+    c->pending.insert(c->pending.end(), (uint8_t*)data, (uint8_t*)data + size);
+    if (c->scheduled) return;
+    c->scheduled = true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(idleMutex_);
+    activeCount_++;
+  }
+  schedule(c);
+}
+
+void PacketEngine::wait() {
+  std::unique_lock<std::mutex> lock(idleMutex_);
+  idleCv_.wait(lock, [this] {
+    return activeCount_ == 0;
+  });
+}
+
+void PacketEngine::setMaxBatchSize(size_t size) {
+  maxBatchSize_ = size;
+}
+
+size_t PacketEngine::threadCount() const {
+  return shards_.size();
+}
+
+std::vector<PacketEngine::ShardStats> PacketEngine::stats() const {
+  std::vector<ShardStats> ret(shards_.size());
+  for (size_t i = 0; i < shards_.size(); i++) {
+    auto& shard = *shards_[i];
+    auto& s = ret[i];
+    s.bytes = shard.bytes;
+    s.batches = shard.batches;
+    s.steals = shard.steals;
+    s.stolen = shard.stolen;
+    s.busyUs = shard.busyUs;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    s.queued = shard.queue.size();
+  }
+  return ret;
+}
+
+void PacketEngine::schedule(Connection* c) {
+  auto& shard = *shards_[c->shard];
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.queue.push_back(c);
+  }
+  shard.cv.notify_one();
+  if (!shard.idle) notifyIdle(c->shard);
+}
+
+/**
+ * 分片繁忙 唤醒一个空闲线程来窃取
+ */
+void PacketEngine::notifyIdle(size_t busy) {
+  for (size_t i = 1; i < shards_.size(); i++) {
+    auto& shard = *shards_[(busy + i) % shards_.size()];
+    if (!shard.idle) continue;
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.wake = true;
+    }
+    shard.cv.notify_one();
+    return;
+  }
+}
+
+/**
+ * 先从本分片取 没有时从其他分片队尾窃取
+ */
+PacketEngine::Connection* PacketEngine::popConnection(size_t index) {
+  {
+    auto& shard = *shards_[index];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (!shard.queue.empty()) {
+      auto c = shard.queue.front();
+      shard.queue.pop_front();
+      return c;
+    }
+  }
+
+  for (size_t i = 1; i < shards_.size(); i++) {
+    auto& victim = *shards_[(index + i) % shards_.size()];
+    std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+    // 从队尾窃取 队首留给其所属线程
+    if (!lock.owns_lock() || victim.queue.empty()) continue;
+    auto c = victim.queue.back();
+    victim.queue.pop_back();
+    lock.unlock();
+
+    c->shard = index;
+    victim.stolen++;
+    shards_[index]->steals++;
+    PacketProcessor_LOGV("shard %zu steal from %zu", index, (index + i) % shards_.size());
+    return c;
+  }
+  return nullptr;
+}
+
+void PacketEngine::workerLoop(size_t index) {
+  auto& shard = *shards_[index];
+  auto interval = STEAL_INTERVAL_MIN;
+  for (;;) {
+    auto c = popConnection(index);
+    if (c) {
+      process(index, c);
+      interval = STEAL_INTERVAL_MIN;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    if (!running_ && shard.queue.empty()) break;
+    shard.idle = true;
+    const bool woken = shard.cv.wait_for(lock, interval, [&] {
+      return !shard.queue.empty() || shard.wake || !running_;
+    });
+    shard.idle = false;
+    shard.wake = false;
+    if (!woken) interval = std::min(interval * 2, STEAL_INTERVAL_MAX);
+  }
+}
+
+void PacketEngine::process(size_t index, Connection* c) {
+  auto& shard = *shards_[index];
+  const auto start = std::chrono::steady_clock::now();
+
+  size_t processed = 0;
+  bool done = false;
+  bool closed = false;
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(c->mutex);
+      if (c->pending.empty()) {
+        // 积压已处理完 回到所属分片 下次feed在那里排队
+        c->shard = c->home;
+        c->scheduled = false;
+        closed = c->closed;
+        done = true;
+        break;
+      }
+      if (processed >= maxBatchSize_) break;
+      c->pending.swap(c->working);
+    }
+
+    c->processor->feed(c->working.data(), c->working.size());
+    processed += c->working.size();
+    shard.batches++;
+    c->working.clear();
+  }
+
+  shard.bytes += processed;
+  shard.busyUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+  if (!done) {
+    // 还有数据 重新排队让其他连接有机会处理
+    schedule(c);
+    return;
+  }
+
+  if (closed) destroyConnection(c);
+
+  std::lock_guard<std::mutex> lock(idleMutex_);
+  if (--activeCount_ == 0) idleCv_.notify_all();
+}
+
+void PacketEngine::destroyConnection(Connection* c) {
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex_);
+    connections_.erase(c);
+  }
+  delete c;
+}
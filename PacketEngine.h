@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "PacketProcessor.h"
+
+/**
+ * 多线程解包引擎
+ * 每个工作线程对应一个分片 连接固定分配到分片以保持缓存局部性
+ * feed只将数据追加到连接的待处理缓存 由工作线程批量送入该连接的PacketProcessor
+ * 分片繁忙时唤醒空闲线程整体窃取连接 积压处理完后连接回到所属分片
+ * 同一连接任意时刻只由一个线程处理 保证数据顺序
+ * OnPacketHandle在工作线程中回调
+ */
+class PacketEngine {
+ public:
+  struct Connection;
+
+  struct ShardStats {
+    uint64_t bytes = 0;    // 处理的字节数
+    uint64_t batches = 0;  // 批处理次数
+    uint64_t steals = 0;   // 从其他分片窃取的连接数
+    uint64_t stolen = 0;   // 被其他分片窃取的连接数
+    uint64_t busyUs = 0;   // 处理耗时
+    size_t queued = 0;     // 当前等待处理的连接数
+  };
+
+ public:
+  /**
+   * @param threads 工作线程数 为0时使用CPU核数
+   */
+  explicit PacketEngine(size_t threads = 0);
+
+  ~PacketEngine();
+
+  PacketEngine(const PacketEngine&) = delete;
+  PacketEngine& operator=(const PacketEngine&) = delete;
+
+ public:
+  /**
+   * 添加连接 由引擎持有processor 添加后不可再在其他线程中使用它
+   * @param processor
+   * @return 连接句柄 用于feed和removeConnection
+   */
+  Connection* addConnection(std::unique_ptr<PacketProcessor> processor);
+
+  /**
+   * 移除连接 已送入的数据会处理完后再释放 之后不可再使用此句柄
+   * @param connection
+   */
+  void removeConnection(Connection* connection);
+
+  /**
+   * 送数据 可在任意线程调用 同一连接的数据按调用顺序处理
+   * @param connection
+   * @param data
+   * @param size
+   */
+  void feed(Connection* connection, const void* data, size_t size);
+
+  /**
+   * 等待所有已送入的数据处理完成
+   */
+  void wait();
+
+  /**
+   * 单个连接每次最多连续处理的字节数 超过后重新排队 避免大流量连接占用线程 默认64KBytes
+   * @param size
+   */
+  void setMaxBatchSize(size_t size);
+
+  size_t threadCount() const;
+
+  std::vector<ShardStats> stats() const;
+
+ private:
+  struct Shard;
+
+  void schedule(Connection* connection);
+
+  void notifyIdle(size_t busy);
+
+  Connection* popConnection(size_t shard);
+
+  void workerLoop(size_t shard);
+
+  void process(size_t shard, Connection* connection);
+
+  void destroyConnection(Connection* connection);
+
+ private:
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<bool> running_{true};
+  std::atomic<size_t> nextShard_{0};
+  size_t maxBatchSize_ = 64 * 1024;
+
+  std::mutex connectionsMutex_;
+  std::unordered_set<Connection*> connections_;
+
+  std::mutex idleMutex_;
+  std::condition_variable idleCv_;
+  size_t activeCount_ = 0;  // 已排队或正在处理的连接数
+};
@@ -0,0 +1,97 @@
+#include "PacketGovernor.h"
+
+#include <algorithm>
+
+// #define PacketProcessor_LOG_SHOW_VERBOSE
+#include "log.h"
+
+void PacketGovernor::add(PacketProcessor* processor) {
+  processors_.push_back(processor);
+}
+
+void PacketGovernor::remove(PacketProcessor* processor) {
+  processors_.erase(std::remove(processors_.begin(), processors_.end(), processor), processors_.end());
+}
+
+void PacketGovernor::setMemoryLimit(size_t bytes) {
+  memoryLimit_ = bytes;
+}
+
+void PacketGovernor::setPartialTimeout(Clock::duration timeout) {
+  partialTimeout_ = timeout;
+}
+
+size_t PacketGovernor::poll(Clock::time_point now) {
+  size_t dropped = 0;
+  if (partialTimeout_ != Clock::duration::zero()) {
+    for (auto processor : processors_) {
+      const auto since = processor->partialSince();
+      if (since == Clock::time_point() || now - since < partialTimeout_) continue;
+      PacketProcessor_LOGW("partial frame timeout, drop: %zu", processor->pendingSize());
+      if (processor->evict()) {
+        stats_.expired++;
+        dropped++;
+      }
+    }
+  }
+  if (memoryLimit_ != 0) {
+    dropped += enforceLimit();
+  }
+  return dropped;
+}
+
+size_t PacketGovernor::enforceLimit() {
+  size_t usage = memoryUsage();
+  if (usage <= memoryLimit_) return 0;
+
+  // 先释放空闲缓存 不丢弃数据
+  for (auto processor : processors_) {
+    const size_t before = processor->releasableCapacity();
+    processor->trim();
+    const size_t after = processor->releasableCapacity();
+    if (after < before) {
+      usage -= before - after;
+      stats_.trimmed++;
+    }
+  }
+  if (usage <= memoryLimit_) return 0;
+
+  // 再从最久没有进展的未完成数据包开始丢弃 只丢弃能释放内存的
+  partials_.clear();
+  for (auto processor : processors_) {
+    if (processor->partialSince() != Clock::time_point() && processor->releasableCapacity() > 0) partials_.push_back(processor);
+  }
+  std::sort(partials_.begin(), partials_.end(), [](const PacketProcessor* a, const PacketProcessor* b) {
+    return a->partialSince() < b->partialSince();
+  });
+
+  size_t dropped = 0;
+  for (auto processor : partials_) {
+    if (usage <= memoryLimit_) break;
+    const size_t before = processor->releasableCapacity();
+    PacketProcessor_LOGW("memory limit exceeded: %zu > %zu, drop: %zu", usage, memoryLimit_, processor->pendingSize());
+    if (processor->evict()) {
+      stats_.evicted++;
+      dropped++;
+    }
+    // 按实际释放的字节数计算
+    usage -= before - processor->releasableCapacity();
+  }
+  return dropped;
+}
+
+size_t PacketGovernor::memoryUsage() const {
+  size_t usage = 0;
+  for (auto processor : processors_) {
+    usage += processor->releasableCapacity();
+  }
+  return usage;
+}
+
+size_t PacketGovernor::size() const {
+  return processors_.size();
+}
+
+const PacketGovernor::Stats& PacketGovernor::stats() const {
+  return stats_;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "PacketProcessor.h"
+
+/**
+ * 多个PacketProcessor的缓存内存管理 避免大量空闲连接上的未完成数据包长期占用内存
+ * poll时依次:
+ * 1. 丢弃超过partialTimeout的未完成数据包
+ * 2. 总缓存超过memoryLimit时释放空闲的缓存
+ * 3. 仍超过时从最久没有收到数据的未完成数据包起依次丢弃 直到低于memoryLimit
+ * 只统计可释放的堆内存 使用外部内存(setBuffer)的processor不计入也不会因内存上限被丢弃
+ * 非线程安全 需与各processor的feed在同一线程调用
+ */
+class PacketGovernor {
+ public:
+  using Clock = PacketProcessor::Clock;
+
+  struct Stats {
+    uint64_t expired = 0;  // 超时丢弃的未完成数据包数
+    uint64_t evicted = 0;  // 内存不足丢弃的未完成数据包数
+    uint64_t trimmed = 0;  // 内存不足时释放空闲缓存的次数
+  };
+
+ public:
+  PacketGovernor() = default;
+
+  PacketGovernor(const PacketGovernor&) = delete;
+  PacketGovernor& operator=(const PacketGovernor&) = delete;
+
+ public:
+  /**
+   * 添加管理的processor 不持有它 需在其析构前remove
+   * @param processor
+   */
+  void add(PacketProcessor* processor);
+
+  void remove(PacketProcessor* processor);
+
+  /**
+   * 所有processor缓存占用的内存上限 为0时不限制(默认)
+   * @param bytes
+   */
+  void setMemoryLimit(size_t bytes);
+
+  /**
+   * 未完成数据包没有新数据到达的最长时间 为0时不超时(默认)
+   * @param timeout
+   */
+  void setPartialTimeout(Clock::duration timeout);
+
+  /**
+   * 检查超时和内存上限 用于由事件循环定时调用
+   * @param now
+   * @return 本次丢弃的未完成数据包数
+   */
+  size_t poll(Clock::time_point now = Clock::now());
+
+  /**
+   * @return 所有processor可释放的缓存字节数
+   */
+  size_t memoryUsage() const;
+
+  size_t size() const;
+
+  const Stats& stats() const;
+
+ private:
+  size_t enforceLimit();
+
+ private:
+  std::vector<PacketProcessor*> processors_;
+  std::vector<PacketProcessor*> partials_;  // 按最后收到数据的时间排序的候选 复用以避免每次分配
+  size_t memoryLimit_ = 0;
+  Clock::duration partialTimeout_{0};
+  Stats stats_;
+};
@@ -0,0 +1,231 @@
+#include "PacketIndex.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include "crc/checksum.h"
+
+// #define PacketProcessor_LOG_SHOW_VERBOSE
+#include "log.h"
+
+static const char MAGIC[4] = {'P', 'P', 'I', 'X'};
+static const uint8_t VERSION = 1;
+
+static void writeVarint(std::string& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back((char)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((char)v);
+}
+
+static bool readVarint(const uint8_t*& p, const uint8_t* end, uint64_t* v) {
+  *v = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7) {
+    if (p >= end) return false;
+    uint8_t b = *p++;
+    *v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+PacketIndex::PacketIndex(const PacketProcessor& processor) : processor_(processor) {}
+
+void PacketIndex::setTimestampSampler(uint32_t interval, const TimestampHandle& handle) {
+  sampleInterval_ = interval;
+  timestampHandle_ = handle;
+}
+
+size_t PacketIndex::build(const void* s, size_t size, uint64_t baseOffset, bool final) {
+  const uint8_t* stream = (uint8_t*)s;
+  const size_t oldCount = entries_.size();
+  assert(entries_.empty() || baseOffset >= entries_.back().offset + entries_.back().size);
+
+  size_t pos = 0;
+  while (pos < size) {
+    const uint8_t* payload;
+    size_t payloadSize;
+    bool incomplete;
+    size_t frameSize = processor_.checkPacket(stream + pos, size - pos, &payload, &payloadSize, &incomplete);
+    if (frameSize == 0) {
+      // 跨越块结尾的数据包留给下一块 最后一块时为无效的包头
+      if (incomplete && !final) break;
+      pos++;
+      continue;
+    }
+
+    const uint64_t frame = entries_.size();
+    if (sampleInterval_ && timestampHandle_ && frame % sampleInterval_ == 0) {
+      samples_.push_back({frame, timestampHandle_(payload, payloadSize)});
+    }
+    entries_.push_back({baseOffset + pos, (uint32_t)frameSize});
+    pos += frameSize;
+  }
+
+  PacketProcessor_LOGD("index build: %zu frames, %zu bytes left", entries_.size() - oldCount, size - pos);
+  return pos;
+}
+
+void PacketIndex::clear() {
+  entries_.clear();
+  samples_.clear();
+}
+
+size_t PacketIndex::size() const {
+  return entries_.size();
+}
+
+const PacketIndex::Entry& PacketIndex::operator[](size_t frame) const {
+  return entries_[frame];
+}
+
+const std::vector<PacketIndex::TimeSample>& PacketIndex::timeSamples() const {
+  return samples_;
+}
+
+size_t PacketIndex::findByOffset(uint64_t offset) const {
+  auto it = std::lower_bound(entries_.cbegin(), entries_.cend(), offset, [](const Entry& e, uint64_t offset) {
+    return e.offset < offset;
+  });
+  if (it == entries_.cend()) return npos;
+  return it - entries_.cbegin();
+}
+
+size_t PacketIndex::findByTime(uint64_t timestamp) const {
+  auto it = std::upper_bound(samples_.cbegin(), samples_.cend(), timestamp, [](uint64_t timestamp, const TimeSample& s) {
+    return timestamp < s.timestamp;
+  });
+  if (it == samples_.cbegin()) return npos;
+  return (it - 1)->frame;
+}
+
+PacketIndex::Slice PacketIndex::slice(size_t first, size_t last) const {
+  assert(first <= last && last <= entries_.size());
+  if (first == last) return {0, 0};
+  const auto& back = entries_[last - 1];
+  return {entries_[first].offset, back.offset + back.size - entries_[first].offset};
+}
+
+bool PacketIndex::replay(const void* stream, size_t size, size_t first, size_t last, PacketProcessor& processor, uint64_t baseOffset) const {
+  if (first >= last) return true;
+  const Slice s = slice(first, last);
+  if (s.offset < baseOffset || s.offset - baseOffset + s.size > size) {
+    PacketProcessor_LOGE("replay out of range: offset=%llu, size=%llu", (unsigned long long)s.offset, (unsigned long long)s.size);
+    return false;
+  }
+  // 逐个送入数据包 片段可能远大于maxBufferSize 也不与processor中残留的数据拼接
+  processor.clearBuffer();
+  const uint8_t* base = (uint8_t*)stream - baseOffset;
+  for (size_t i = first; i < last; i++) {
+    processor.feed(base + entries_[i].offset, entries_[i].size);
+  }
+  return true;
+}
+
+/**
+ * 格式: "PPIX"+版本1字节+数据包数+采样数+每个数据包(与上一个包结尾的间隔,长度)+每个采样(序号增量,时间戳)+CRC16 2字节
+ * 除头尾外均为varint
+ */
+std::string PacketIndex::serialize() const {
+  std::string out(MAGIC, sizeof(MAGIC));
+  out.push_back((char)VERSION);
+  writeVarint(out, entries_.size());
+  writeVarint(out, samples_.size());
+
+  uint64_t end = 0;
+  for (const auto& e : entries_) {
+    writeVarint(out, e.offset - end);
+    writeVarint(out, e.size);
+    end = e.offset + e.size;
+  }
+
+  uint64_t frame = 0;
+  for (const auto& s : samples_) {
+    writeVarint(out, s.frame - frame);
+    writeVarint(out, s.timestamp);
+    frame = s.frame;
+  }
+
+  uint16_t crc = crc_16((uint8_t*)out.data(), out.size());
+  out.push_back((char)(crc >> 8));
+  out.push_back((char)(crc & 0xff));
+  return out;
+}
+
+bool PacketIndex::deserialize(const void* d, size_t size) {
+  const uint8_t* data = (uint8_t*)d;
+  if (size < sizeof(MAGIC) + 1 + 2) return false;
+  if (memcmp(data, MAGIC, sizeof(MAGIC)) != 0 || data[sizeof(MAGIC)] != VERSION) {
+    PacketProcessor_LOGE("index format error");
+    return false;
+  }
+  const uint8_t* end = data + size - 2;
+  uint16_t crc = (uint16_t)(end[0] << 8 | end[1]);
+  if (crc != crc_16(data, size - 2)) {
+    PacketProcessor_LOGE("index crc error");
+    return false;
+  }
+
+  const uint8_t* p = data + sizeof(MAGIC) + 1;
+  uint64_t count, sampleCount;
+  if (!readVarint(p, end, &count) || !readVarint(p, end, &sampleCount)) return false;
+  // 每项至少2字节 避免错误数据导致过量分配
+  if (count > (uint64_t)(end - p) / 2 || sampleCount > (uint64_t)(end - p) / 2) return false;
+
+  std::vector<Entry> entries;
+  entries.reserve(count);
+  uint64_t offset = 0;
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t gap, frameSize;
+    if (!readVarint(p, end, &gap) || !readVarint(p, end, &frameSize)) return false;
+    offset += gap;
+    entries.push_back({offset, (uint32_t)frameSize});
+    offset += frameSize;
+  }
+
+  std::vector<TimeSample> samples;
+  samples.reserve(sampleCount);
+  uint64_t frame = 0;
+  for (uint64_t i = 0; i < sampleCount; i++) {
+    uint64_t delta, timestamp;
+    if (!readVarint(p, end, &delta) || !readVarint(p, end, &timestamp)) return false;
+    frame += delta;
+    samples.push_back({frame, timestamp});
+  }
+  if (p != end) return false;
+
+  entries_.swap(entries);
+  samples_.swap(samples);
+  return true;
+}
+
+bool PacketIndex::save(const char* path) const {
+  FILE* fp = fopen(path, "wb");
+  if (fp == nullptr) {
+    PacketProcessor_LOGE("open failed: %s", path);
+    return false;
+  }
+  auto data = serialize();
+  bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+  ok = fclose(fp) == 0 && ok;
+  return ok;
+}
+
+bool PacketIndex::load(const char* path) {
+  FILE* fp = fopen(path, "rb");
+  if (fp == nullptr) {
+    PacketProcessor_LOGE("open failed: %s", path);
+    return false;
+  }
+  std::string data;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    data.append(buf, n);
+  }
+  fclose(fp);
+  return deserialize(data.data(), data.size());
+}
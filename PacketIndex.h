@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "PacketProcessor.h"
+
+/**
+ * 已记录数据流的数据包索引
+ * 扫描一次数据流 记录每个有效数据包的偏移和长度 之后可按序号、字节偏移或时间戳定位 只解析需要的片段
+ * 索引可序列化为紧凑的边车文件(变长编码)
+ */
+class PacketIndex {
+ public:
+  struct Entry {
+    uint64_t offset;  // 数据包在数据流中的偏移
+    uint32_t size;    // 数据包总长度 包括头、长度、校验等
+  };
+
+  struct TimeSample {
+    uint64_t frame;      // 数据包序号
+    uint64_t timestamp;  // 由TimestampHandle给出
+  };
+
+  struct Slice {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  /**
+   * 提取时间戳
+   * @param data 数据包的数据(压缩的数据包为压缩后的数据)
+   * @param size
+   */
+  using TimestampHandle = std::function<uint64_t(const uint8_t* data, size_t size)>;
+
+  static const size_t npos = (size_t)-1;
+
+ public:
+  /**
+   * @param processor 用于校验数据包 需与记录时的配置(CRC)一致
+   */
+  explicit PacketIndex(const PacketProcessor& processor);
+
+ public:
+  /**
+   * 每interval个数据包采样一次时间戳 需在build前设置
+   * @param interval
+   * @param handle
+   */
+  void setTimestampSampler(uint32_t interval, const TimestampHandle& handle);
+
+  /**
+   * 扫描数据流并追加索引 可多次调用以索引连续的数据块
+   * 遇到结尾不完整的数据包时停止 调用者将剩余的字节与下一块拼接 从baseOffset+返回值处继续
+   * @param stream
+   * @param size
+   * @param baseOffset stream在整个数据流中的偏移
+   * @param final 是否为数据流的最后一块 为true时不完整的数据包视为无效 继续扫描其后的数据
+   * @return 已扫描的字节数 等于size时没有剩余
+   */
+  size_t build(const void* stream, size_t size, uint64_t baseOffset = 0, bool final = false);
+
+  void clear();
+
+  size_t size() const;
+
+  const Entry& operator[](size_t frame) const;
+
+  const std::vector<TimeSample>& timeSamples() const;
+
+  /**
+   * @param offset 数据流中的字节偏移
+   * @return 第一个起始偏移不小于offset的数据包序号 不存在时返回npos
+   */
+  size_t findByOffset(uint64_t offset) const;
+
+  /**
+   * @param timestamp
+   * @return 不晚于timestamp的最后一个采样对应的数据包序号 不存在时返回npos
+   */
+  size_t findByTime(uint64_t timestamp) const;
+
+  /**
+   * @return 数据包[first, last)在数据流中所占的字节范围 包括其间的无效数据
+   */
+  Slice slice(size_t first, size_t last) const;
+
+  /**
+   * 将数据包[first, last)逐个送入processor解析 跳过其间的无效数据 会先清空processor中未完成的数据
+   * @param stream 完整的数据流(或从baseOffset开始的部分)
+   * @param size
+   * @param first
+   * @param last
+   * @param processor
+   * @param baseOffset stream在整个数据流中的偏移
+   * @return 是否在stream范围内
+   */
+  bool replay(const void* stream, size_t size, size_t first, size_t last, PacketProcessor& processor, uint64_t baseOffset = 0) const;
+
+  /**
+   * 序列化为边车文件内容
+   */
+  std::string serialize() const;
+
+  /**
+   * 从边车文件内容加载 会替换当前索引
+   * @return 格式或校验错误时返回false
+   */
+  bool deserialize(const void* data, size_t size);
+
+  bool save(const char* path) const;
+
+  bool load(const char* path);
+
+ private:
+  const PacketProcessor& processor_;
+
+  uint32_t sampleInterval_ = 0;
+  TimestampHandle timestampHandle_;
+
+  std::vector<Entry> entries_;
+  std::vector<TimeSample> samples_;
+};
@@ -1,9 +1,23 @@
 #include "PacketProcessor.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <utility>
 
+#ifdef PacketProcessor_WITH_PARALLEL_CRC
+#include "PacketCrcPool.h"
+#endif
+#ifdef PacketProcessor_ENABLE_TRACE
+#include "PacketTrace.h"
+#define PacketProcessor_TRACE(stmt) stmt
+#else
+#define PacketProcessor_TRACE(stmt) ((void)0)
+#endif
 #include "crc/checksum.h"
+#ifndef PacketProcessor_DISABLE_COMPRESS
+#include "lz/lz.h"
+#endif
 
 // #define PacketProcessor_LOG_SHOW_VERBOSE
 #include "log.h"
@@ -24,38 +38,194 @@ static uint16_t calCrc(T param) {
   return crc_16(tmp, size);
 }
 
+static uint16_t readU16(const uint8_t* p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t readU32(const uint8_t* p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+PacketProcessor::Buffer::Buffer(const Buffer& other) {
+  *this = other;
+}
+
+PacketProcessor::Buffer& PacketProcessor::Buffer::operator=(const Buffer& other) {
+  if (this == &other) return *this;
+  // 总是复制到堆上 外部内存由原对象使用 副本不能共用
+  heap_.reset();
+  data_ = nullptr;
+  capacity_ = 0;
+  external_ = false;
+  const size_t capacity = other.external_ ? other.size_ : other.capacity_;
+  if (capacity) {
+    heap_.reset(new uint8_t[capacity]);
+    data_ = heap_.get();
+    capacity_ = capacity;
+    memcpy(data_, other.data_, other.size_);
+  }
+  size_ = other.size_;
+  return *this;
+}
+
+void PacketProcessor::Buffer::setExternal(uint8_t* data, size_t capacity) {
+  heap_.reset();
+  data_ = data;
+  size_ = 0;
+  capacity_ = data ? capacity : 0;
+  external_ = true;
+}
+
+bool PacketProcessor::Buffer::reserve(size_t capacity) {
+  if (capacity <= capacity_) return true;
+  if (external_) return false;
+  std::unique_ptr<uint8_t[]> tmp(new uint8_t[capacity]);
+  if (size_) memcpy(tmp.get(), data_, size_);
+  heap_ = std::move(tmp);
+  data_ = heap_.get();
+  capacity_ = capacity;
+  return true;
+}
+
+bool PacketProcessor::Buffer::resize(size_t size) {
+  if (!reserve(size)) return false;
+  size_ = size;
+  return true;
+}
+
+bool PacketProcessor::Buffer::append(const uint8_t* data, size_t size) {
+  if (!reserve(size_ + size)) return false;
+  memcpy(data_ + size_, data, size);
+  size_ += size;
+  return true;
+}
+
+void PacketProcessor::Buffer::eraseFront(size_t size) {
+  assert(size <= size_);
+  size_ -= size;
+  if (size_ && size) memmove(data_, data_ + size, size_);
+}
+
+void PacketProcessor::Buffer::release() {
+  size_ = 0;
+  if (external_) return;
+  heap_.reset();
+  data_ = nullptr;
+  capacity_ = 0;
+}
+
 PacketProcessor::PacketProcessor(OnPacketHandle handle, bool useCrc) : onPacketHandle_(std::move(handle)), useCrc_(useCrc) {}
 
 void PacketProcessor::setOnPacketHandle(const OnPacketHandle& handle) {
   onPacketHandle_ = handle;
+  rawPacketHandle_ = nullptr;
+  rawPacketHandleCtx_ = nullptr;
+}
+
+void PacketProcessor::setOnPacketHandle(RawPacketHandle handle, void* ctx) {
+  onPacketHandle_ = nullptr;
+  rawPacketHandle_ = handle;
+  rawPacketHandleCtx_ = ctx;
 }
 
 void PacketProcessor::setUseCrc(bool enable) {
   useCrc_ = enable;
 }
 
+void PacketProcessor::setUseCompactHeader(bool useCompactHeader) {
+  useCompactHeader_ = useCompactHeader;
+  if (useCompactHeader) acceptCompactHeader_ = true;
+}
+
+void PacketProcessor::setAcceptCompactHeader(bool acceptCompactHeader) {
+  acceptCompactHeader_ = acceptCompactHeader;
+}
+
+void PacketProcessor::setUseCompress(bool useCompress) {
+  useCompress_ = useCompress;
+}
+
+void PacketProcessor::setParallelCrcThreshold(size_t size) {
+  parallelCrcThreshold_ = size;
+}
+
 void PacketProcessor::setMaxBufferSize(uint32_t size) {
   assert(size > 0);
   maxBufferSize_ = size + ALL_HEADER_LEN;
+  if (buffer_.isExternal()) {
+    maxBufferSize_ = std::min<size_t>(maxBufferSize_, buffer_.capacity());
+  }
+  clearBuffer();
+}
+
+void PacketProcessor::setBuffer(uint8_t* buffer, size_t size, uint8_t* scratch, size_t scratchSize) {
+  assert(buffer != nullptr && size > ALL_HEADER_LEN);
+  buffer_.setExternal(buffer, size);
+  unpackBuffer_.setExternal(scratch, scratchSize);
+  maxBufferSize_ = (uint32_t)std::min<size_t>(size, UINT32_MAX);
   clearBuffer();
 }
 
+size_t PacketProcessor::bufferCapacity() const {
+  return buffer_.capacity() + unpackBuffer_.capacity();
+}
+
+size_t PacketProcessor::releasableCapacity() const {
+  return (buffer_.isExternal() ? 0 : buffer_.capacity()) + (unpackBuffer_.isExternal() ? 0 : unpackBuffer_.capacity());
+}
+
 void PacketProcessor::clearBuffer() {
-  decltype(buffer_) tmp;
-  tmp.swap(buffer_);
+  buffer_.release();
   findHeader_ = false;
   dataSize_ = 0;
+  compressed_ = false;
+  partialSince_ = Clock::time_point();
+}
+
+void PacketProcessor::setPartialTimeout(Clock::duration timeout) {
+  partialTimeout_ = timeout;
+}
+
+bool PacketProcessor::poll(Clock::time_point now) {
+  if (partialTimeout_ == Clock::duration::zero() || buffer_.empty()) return false;
+  if (now - partialSince_ < partialTimeout_) return false;
+  PacketProcessor_LOGW("partial frame timeout, drop: %zu", buffer_.size());
+  return evict();
+}
+
+bool PacketProcessor::evict() {
+  if (buffer_.empty()) return false;
+  clearBuffer();
+  unpackBuffer_.release();
+  evictions_++;
+  return true;
+}
+
+void PacketProcessor::trim() {
+  if (buffer_.empty()) buffer_.release();
+  unpackBuffer_.release();
+}
+
+size_t PacketProcessor::pendingSize() const {
+  return buffer_.size();
+}
+
+PacketProcessor::Clock::time_point PacketProcessor::partialSince() const {
+  return buffer_.empty() ? Clock::time_point() : partialSince_;
+}
+
+uint64_t PacketProcessor::evictions() const {
+  return evictions_;
 }
 
 std::string PacketProcessor::pack(const void* data, uint32_t size) const {
-  uint32_t payloadSize = size + ALL_HEADER_LEN;
-  std::string payload;
-  payload.reserve(payloadSize);
-  packForeach(data, size, [&](uint8_t* data, size_t size) {
-    while (size--) {
-      payload.push_back((char)*data++);
-    }
-  });
+  if (size > MAX_DATA_SIZE) {
+    PacketProcessor_LOGE("data too big: %u, max: %u", size, MAX_DATA_SIZE);
+    return std::string();
+  }
+  // 输出与packTo相同 直接写入返回值 压缩时也不需要额外缓存
+  std::string payload(size + ALL_HEADER_LEN, '\0');
+  payload.resize(packTo(data, size, &payload[0], payload.size()));
   return payload;
 }
 
@@ -65,34 +235,184 @@ std::string PacketProcessor::pack(const std::string& data) const {
 
 /**
  * 约定形式: 包头2字节(0x5AA5)+数据净长度4字节(大端序)+长度校验2字节(长度CRC16)+数据+校验2字节(数据CRC16/长度CRC16的按位取反)
+ * 紧凑形式: 包头2字节(0x5AC3)+varint(数据净长度<<1|压缩标志)1~2字节+长度校验1字节(varint的CRC16低8位)+数据+校验2字节(同上)
+ *          数据净长度超过COMPACT_MAX_SIZE时使用约定形式
+ * 数据压缩时: 长度最高位置1 数据为原始长度4字节(大端序)+压缩数据
  * @param data
  * @param size
  */
 void PacketProcessor::packForeach(const void* data, uint32_t size, const std::function<void(uint8_t* data, size_t size)>& handle) const {
+  if (size > MAX_DATA_SIZE) {
+    PacketProcessor_LOGE("data too big: %u, max: %u", size, MAX_DATA_SIZE);
+    return;
+  }
   uint8_t tmp[4];
 
-  tmp[0] = H_1;
-  tmp[1] = H_2;
+  uint32_t flag = 0;
+#ifndef PacketProcessor_DISABLE_COMPRESS
+  // 每个线程一份只增不减的压缩缓存 const对象可多线程同时打包且不逐包分配
+  // 使用期间取出 handle中再次打包时使用新的缓存
+  static thread_local std::vector<uint8_t> threadCompressBuffer;
+  std::vector<uint8_t> compressBuffer;
+  if (useCompress_ && size >= COMPRESS_MIN_SIZE) {
+    // 压缩后必须比原始数据小才使用
+    compressBuffer.swap(threadCompressBuffer);
+    if (compressBuffer.size() < size) compressBuffer.resize(size);
+    uint8_t* out = compressBuffer.data();
+    size_t compressedSize = lz_compress((uint8_t*)data, size, out + COMPRESS_SIZE_LEN, size - COMPRESS_SIZE_LEN - 1);
+    if (compressedSize != 0) {
+      out[0] = (size & 0xff000000) >> 8 * 3;
+      out[1] = (size & 0x00ff0000) >> 8 * 2;
+      out[2] = (size & 0x0000ff00) >> 8 * 1;
+      out[3] = (size & 0x000000ff) >> 8 * 0;
+      PacketProcessor_LOGV("compress: %u -> %zu", size, compressedSize + COMPRESS_SIZE_LEN);
+      data = out;
+      size = compressedSize + COMPRESS_SIZE_LEN;
+      flag = COMPRESS_FLAG;
+    }
+  }
+#endif
+
+  if (useCompactHeader_ && size <= COMPACT_MAX_SIZE) {
+    uint8_t header[HEADER_LEN + COMPACT_LEN_MAX + COMPACT_LEN_CHECK];
+    handle(header, packCompactHeader(header, size, flag != 0));
+  } else {
+    uint8_t header[HEADER_LEN + LEN_BYTES];
+    packClassicHeader(header, size | flag);
+    handle(header, sizeof(header));
+  }
+
+  handle((uint8_t*)data, size);
+
+  uint16_t crcSum = calDataCrc((uint8_t*)data, size);
+  tmp[0] = (crcSum & 0xff00) >> 8 * 1;
+  tmp[1] = (crcSum & 0x00ff) >> 8 * 0;
   handle(tmp, 2);
+#ifndef PacketProcessor_DISABLE_COMPRESS
+  if (compressBuffer.size() > threadCompressBuffer.size()) compressBuffer.swap(threadCompressBuffer);
+#endif
+}
+
+uint8_t* PacketProcessor::packInPlace(uint8_t* buffer, uint32_t size, size_t* frameSize) const {
+  if (size > MAX_DATA_SIZE) {
+    PacketProcessor_LOGE("data too big: %u, max: %u", size, MAX_DATA_SIZE);
+    *frameSize = 0;
+    return nullptr;
+  }
+  return packInPlace(buffer, size, false, frameSize);
+}
+
+uint8_t* PacketProcessor::packInPlace(uint8_t* buffer, uint32_t size, bool compressed, size_t* frameSize) const {
+  uint8_t* data = buffer + HEADROOM;
+  uint8_t* frame = buffer;
+  if (useCompactHeader_ && size <= COMPACT_MAX_SIZE) {
+    uint8_t header[HEADER_LEN + COMPACT_LEN_MAX + COMPACT_LEN_CHECK];
+    size_t headerLen = packCompactHeader(header, size, compressed);
+    frame = data - headerLen;
+    memcpy(frame, header, headerLen);
+  } else {
+    packClassicHeader(frame, size | (compressed ? COMPRESS_FLAG : 0));
+  }
+
+  uint16_t crcSum = calDataCrc(data, size);
+  data[size] = (crcSum & 0xff00) >> 8 * 1;
+  data[size + 1] = (crcSum & 0x00ff) >> 8 * 0;
+
+  *frameSize = (data - frame) + size + CHECK_LEN;
+  return frame;
+}
 
-  uint32_t dataSize = size;
+size_t PacketProcessor::packTo(const void* data, uint32_t size, void* o, size_t capacity) const {
+  uint8_t* out = (uint8_t*)o;
+  if (size > MAX_DATA_SIZE || capacity < (size_t)size + ALL_HEADER_LEN) return 0;
+
+  // 与packForeach相同的压缩参数 直接压缩到输出位置
+  uint8_t* payload = out + HEADROOM;
+  uint32_t payloadSize = size;
+  bool compressed = false;
+#ifndef PacketProcessor_DISABLE_COMPRESS
+  if (useCompress_ && size >= COMPRESS_MIN_SIZE) {
+    size_t compressedSize = lz_compress((uint8_t*)data, size, payload + COMPRESS_SIZE_LEN, size - COMPRESS_SIZE_LEN - 1);
+    if (compressedSize != 0) {
+      payload[0] = (size & 0xff000000) >> 8 * 3;
+      payload[1] = (size & 0x00ff0000) >> 8 * 2;
+      payload[2] = (size & 0x0000ff00) >> 8 * 1;
+      payload[3] = (size & 0x000000ff) >> 8 * 0;
+      payloadSize = compressedSize + COMPRESS_SIZE_LEN;
+      compressed = true;
+    }
+  }
+#endif
+  if (!compressed) memmove(payload, data, size);
+
+  size_t frameSize;
+  uint8_t* frame = packInPlace(out, payloadSize, compressed, &frameSize);
+  if (frame != out) memmove(out, frame, frameSize);
+  return frameSize;
+}
+
+void PacketProcessor::packClassicHeader(uint8_t* header, uint32_t dataSize) {
+  header[0] = H_1;
+  header[1] = H_2;
+
+  uint8_t* tmp = header + HEADER_LEN;
   tmp[0] = (dataSize & 0xff000000) >> 8 * 3;
   tmp[1] = (dataSize & 0x00ff0000) >> 8 * 2;
   tmp[2] = (dataSize & 0x0000ff00) >> 8 * 1;
   tmp[3] = (dataSize & 0x000000ff) >> 8 * 0;
-  handle(tmp, 4);
 
   uint16_t sizeCrc = crc_16(tmp, 4);
-  tmp[0] = (sizeCrc & 0xff00) >> 8 * 1;
-  tmp[1] = (sizeCrc & 0x00ff) >> 8 * 0;
-  handle(tmp, 2);
+  tmp[4] = (sizeCrc & 0xff00) >> 8 * 1;
+  tmp[5] = (sizeCrc & 0x00ff) >> 8 * 0;
+}
 
-  handle((uint8_t*)data, size);
+/**
+ * @return 紧凑形式包头长度
+ */
+size_t PacketProcessor::packCompactHeader(uint8_t* header, uint32_t size, bool compressed) {
+  header[0] = H_1;
+  header[1] = H_2_COMPACT;
+
+  assert(size <= COMPACT_MAX_SIZE);
+  uint32_t v = size << 1 | (compressed ? 1 : 0);
+  size_t n = HEADER_LEN;
+  while (v >= 0x80) {
+    header[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  header[n++] = (uint8_t)v;
 
-  uint16_t crcSum = useCrc_ ? crc_16((uint8_t*)data, size) : ~calCrc(size);
-  tmp[0] = (crcSum & 0xff00) >> 8 * 1;
-  tmp[1] = (crcSum & 0x00ff) >> 8 * 0;
-  handle(tmp, 2);
+  header[n] = crc_16(header + HEADER_LEN, n - HEADER_LEN) & 0xff;
+  return n + COMPACT_LEN_CHECK;
+}
+
+size_t PacketProcessor::checkPacket(const void* d, size_t size, const uint8_t** payload, size_t* payloadSize, bool* incomplete) const {
+  const uint8_t* data = (uint8_t*)d;
+  if (incomplete) *incomplete = false;
+  if (size == 0 || data[0] != H_1) return 0;
+  if (size < HEADER_LEN) {
+    if (incomplete) *incomplete = true;
+    return 0;
+  }
+  if (!isSync2(data[1])) return 0;
+
+  uint32_t dataSize;
+  bool compressed;
+  size_t dataPos;
+  const LengthStatus status = parseLength(data, size, &dataSize, &compressed, &dataPos);
+  if (status != LengthStatus::OK) {
+    if (incomplete) *incomplete = status == LengthStatus::NEED_MORE;
+    return 0;
+  }
+  if (size - dataPos < (size_t)dataSize + CHECK_LEN) {
+    if (incomplete) *incomplete = true;
+    return 0;
+  }
+
+  if (readU16(data + dataPos + dataSize) != calDataCrc(data + dataPos, dataSize)) return 0;
+  if (payload) *payload = data + dataPos;
+  if (payloadSize) *payloadSize = dataSize;
+  return dataPos + dataSize + CHECK_LEN;
 }
 
 void PacketProcessor::feed(const void* d, size_t size) {
@@ -107,58 +427,113 @@ void PacketProcessor::feed(const void* d, size_t size) {
     FOR(i, size) {
       if (data[i] == H_1) {
         if (i + 1 < size) {
-          if (data[i + 1] == H_2) {
+          if (isSync2(data[i + 1])) {
             startPos = i;
             goto START_BUFFER;
           } else {
             continue;
           }
         } else {
-          buffer_.push_back(data[i]);
+          buffer_.append(data + i, 1);
+          partialSince_ = Clock::now();
           return;
         }
       }
     }
   } else if (buffer_.size() == 1) {
     assert(buffer_[0] == H_1);
-    if (data[0] == H_2)
+    if (isSync2(data[0]))
       goto START_BUFFER;
     else {
+      // 保留容量 避免稳定状态下反复分配
       buffer_.clear();
-      buffer_.shrink_to_fit();
+      partialSince_ = Clock::time_point();
       goto START_HEADER;
     }
   } else {
   START_BUFFER:
-    const auto needSize = buffer_.size() + size - startPos;
-    if (needSize > maxBufferSize_) {
-      PacketProcessor_LOGW("size too big, need: %zu, max: %zu", needSize, (size_t)maxBufferSize_);
-      clearBuffer();
-      return;
-    }
-    buffer_.insert(buffer_.end(), data + startPos, data + size - startPos);
+    if (not appendBuffer(data + startPos, size - startPos, 0)) return;
   }
 
   // 尝试解包
   tryUnpack();
+
+  // 未完成的数据包收到了数据 从此刻重新计时
+  if (!buffer_.empty()) partialSince_ = Clock::now();
+}
+
+void PacketProcessor::feedv(const struct iovec* iov, size_t count) {
+  bool fed = false;
+  FOR(i, count) {
+    auto data = (uint8_t*)iov[i].iov_base;
+    size_t size = iov[i].iov_len;
+    PacketProcessor_LOGV("feedv: %zu", size);
+    fed = fed || size > 0;
+
+    while (size > 0) {
+      if (buffer_.empty()) {
+        const size_t done = unpackDirect(data, size);
+        data += done;
+        size -= done;
+        if (size == 0) break;
+        // 剩余为不完整的数据包 全部属于它
+        if (appendBuffer(data, size, 0)) tryUnpack();
+        break;
+      }
+
+      // 补齐缓存中的数据包 只拷贝它需要的字节 数据包完成后其余数据回到直接解包
+      const size_t n = std::min(size, bufferNeed());
+      if (not appendBuffer(data, n, findHeader_ && dataSize_ != 0 ? getNextPacketPos() : 0)) break;
+      data += n;
+      size -= n;
+      tryUnpack();
+    }
+  }
+
+  // 未完成的数据包收到了数据 从此刻重新计时
+  if (!buffer_.empty() && fed) partialSince_ = Clock::now();
+}
+
+/**
+ * 追加到缓存 超过最大缓存字节数或外部缓存空间不足时丢弃已缓存的数据
+ * @param reserveSize 需要扩容时至少预留的字节数 如已知的数据包总长度
+ * @return 是否追加成功
+ */
+bool PacketProcessor::appendBuffer(const uint8_t* data, size_t size, size_t reserveSize) {
+  const auto needSize = buffer_.size() + size;
+  if (needSize > maxBufferSize_) {
+    PacketProcessor_LOGW("size too big, need: %zu, max: %zu", needSize, (size_t)maxBufferSize_);
+    clearBuffer();
+    return false;
+  }
+  // 按倍数扩容 使稳定状态下不再分配
+  if (needSize > buffer_.capacity()) {
+    buffer_.reserve(std::min<size_t>(std::max<size_t>(std::max(needSize, reserveSize), buffer_.capacity() * 2), maxBufferSize_));
+  }
+  if (not buffer_.append(data, size)) {
+    PacketProcessor_LOGE("buffer full, need: %zu, capacity: %zu", needSize, buffer_.capacity());
+    clearBuffer();
+    return false;
+  }
+  return true;
 }
 
 size_t PacketProcessor::getDataPos() {
-  assert(buffer_.size() >= dataSize_ + ALL_HEADER_LEN);
-  return HEADER_LEN + LEN_BYTES;
+  assert(buffer_.size() >= getNextPacketPos());
+  return dataPos_;
 }
 
 /**
  * @return 数据净长度 不包括头、长度、校验等
  */
 size_t PacketProcessor::getDataSize() {
-  assert(buffer_.size() >= dataSize_ + ALL_HEADER_LEN);
+  assert(buffer_.size() >= getNextPacketPos());
   return dataSize_;
 }
 
 uint8_t* PacketProcessor::getPayloadPtr() {
   assert(!buffer_.empty());
-  assert(buffer_.size() >= dataSize_ + ALL_HEADER_LEN);
+  assert(buffer_.size() >= getNextPacketPos());
   return buffer_.data() + getDataPos();
 }
 
@@ -168,70 +543,60 @@ bool PacketProcessor::findHeader() {
   FOR(i, buffer_.size()) {
     if (buffer_[i] == H_1) {
       if (i + 1 < buffer_.size()) {
-        if (buffer_[i + 1] == H_2) {
+        if (isSync2(buffer_[i + 1])) {
           if (i != 0) {
-            buffer_.assign(buffer_.cbegin() + i, buffer_.cend());
+            buffer_.eraseFront(i);
           }
           findHeader_ = true;
+          PacketProcessor_TRACE(traceHeader_ = PacketTrace::now());
           return true;
         }
       } else {
-        buffer_.assign(buffer_.cend() - 1, buffer_.cend());
+        buffer_.eraseFront(buffer_.size() - 1);
         return false;
       }
     }
   }
 
+  // 没有包头 丢弃全部数据
+  buffer_.clear();
   return false;
 }
 
 void PacketProcessor::tryUnpack() {
   if (not findHeader()) return;
 
-  // 等足够LEN_BYTES字节时开始计算长度
-  if (buffer_.size() < HEADER_LEN + LEN_BYTES) return;
   if (dataSize_ == 0) {
-    uint32_t size = 0;
-    const unsigned int LEN_BYTES_WITHOUT_CRC = LEN_BYTES - LEN_CRC_B;
-    FOR(i, LEN_BYTES_WITHOUT_CRC) {
-      size += buffer_[HEADER_LEN + i] << (LEN_BYTES_WITHOUT_CRC - i - 1) * 8;
-    }
-
-    if (size == 0) {
-      PacketProcessor_LOGE("size can not be zero!");
-      restart(HEADER_LEN);
-      return;
-    }
-
-    if (size > maxBufferSize_) {
-      PacketProcessor_LOGW("size too big, or data error, restart!");
-      restart(HEADER_LEN);
-      return;
-    }
-
-    uint16_t expectSizeCrc = 0;
-    FOR(i, LEN_CRC_B) {
-      expectSizeCrc += buffer_[HEADER_LEN + LEN_BYTES_WITHOUT_CRC + i] << (LEN_CRC_B - i - 1) * 8;
-    }
-    uint16_t sizeCrc = calCrc<uint32_t>(size);
-    PacketProcessor_LOGV("length crc: 0x%02X  0x%02X", sizeCrc, expectSizeCrc);
-
-    if (sizeCrc != expectSizeCrc) {
-      PacketProcessor_LOGE("size crc error: 0x%02X != 0x%02X", sizeCrc, expectSizeCrc);
-      restart(HEADER_LEN);
-      return;
+    uint32_t size;
+    bool compressed;
+    size_t dataPos;
+    const LengthStatus status = parseLength(buffer_.data(), buffer_.size(), &size, &compressed, &dataPos);
+    switch (status) {
+      case LengthStatus::OK:
+        break;
+      case LengthStatus::NEED_MORE:
+        // 等足够长度字节时开始计算长度
+        return;
+      default:
+        logLengthError(status);
+        restart(HEADER_LEN);
+        return;
     }
     dataSize_ = size;
-    PacketProcessor_LOGD("headerLen_=%zu", dataSize_);
+    dataPos_ = dataPos;
+    compressed_ = compressed;
+    PacketProcessor_TRACE(traceLength_ = PacketTrace::now());
+    PacketProcessor_LOGV("dataSize_=%zu", dataSize_);
   }
 
   // 判断长度是否足够
-  if (buffer_.size() >= dataSize_ + ALL_HEADER_LEN) {
+  if (buffer_.size() >= getNextPacketPos()) {
     PacketProcessor_LOGV("buffer_.size()=%zu", buffer_.size());
+    PacketProcessor_TRACE(traceComplete_ = PacketTrace::now());
     if (checkCrc()) {
-      if (onPacketHandle_) {
-        onPacketHandle_(getPayloadPtr(), getDataSize());
-      }
+      PacketProcessor_TRACE(const uint64_t traceCrc = PacketTrace::now());
+      handlePacket();
+      PacketProcessor_TRACE(PacketTrace::global().record(traceHeader_, traceLength_, traceComplete_, traceCrc, PacketTrace::now()));
       restart(getNextPacketPos());
     } else {
       // 重新从buffer找 防止遗漏
@@ -240,6 +605,150 @@ void PacketProcessor::tryUnpack() {
   }
 }
 
+/**
+ * 缓存为空时直接在输入数据上解包 完整位于其中的数据包不拷贝 规则与tryUnpack相同
+ * @return 已处理的字节数 其后为不完整的数据包或末尾的单个包头字节
+ */
+size_t PacketProcessor::unpackDirect(uint8_t* data, size_t size) {
+  size_t pos = 0;
+  while (pos < size) {
+    auto p = (uint8_t*)memchr(data + pos, H_1, size - pos);
+    if (p == nullptr) return size;
+    pos = p - data;
+    if (pos + 1 == size) return pos;
+    if (not isSync2(p[1])) {
+      pos++;
+      continue;
+    }
+    PacketProcessor_TRACE(const uint64_t traceHeader = PacketTrace::now());
+
+    uint32_t dataSize;
+    bool compressed;
+    size_t dataPos;
+    const LengthStatus status = parseLength(p, size - pos, &dataSize, &compressed, &dataPos);
+    if (status == LengthStatus::NEED_MORE) return pos;
+    if (status != LengthStatus::OK) {
+      logLengthError(status);
+      pos += HEADER_LEN;
+      continue;
+    }
+    PacketProcessor_TRACE(const uint64_t traceLength = PacketTrace::now());
+
+    const size_t frameSize = dataPos + dataSize + CHECK_LEN;
+    if (size - pos < frameSize) return pos;
+    PacketProcessor_TRACE(const uint64_t traceComplete = PacketTrace::now());
+    const uint16_t expectDataCrc = calDataCrc(p + dataPos, dataSize);
+    const uint16_t dataCrc = readU16(p + dataPos + dataSize);
+    if (dataCrc != expectDataCrc) {
+      PacketProcessor_LOGE("data crc error: 0x%02X != 0x%02X", dataCrc, expectDataCrc);
+      pos += HEADER_LEN;
+      continue;
+    }
+    PacketProcessor_TRACE(const uint64_t traceCrc = PacketTrace::now());
+    deliver(p + dataPos, dataSize, compressed);
+    PacketProcessor_TRACE(PacketTrace::global().record(traceHeader, traceLength, traceComplete, traceCrc, PacketTrace::now()));
+    pos += frameSize;
+  }
+  return size;
+}
+
+/**
+ * @return 缓存中的数据包还需要的字节数 长度未知时为包头的最大长度
+ */
+size_t PacketProcessor::bufferNeed() {
+  if (findHeader_ && dataSize_ != 0) return getNextPacketPos() - buffer_.size();
+  return buffer_.size() < HEADER_LEN + LEN_BYTES ? HEADER_LEN + LEN_BYTES - buffer_.size() : 1;
+}
+
+void PacketProcessor::logLengthError(LengthStatus status) {
+  switch (status) {
+    case LengthStatus::ZERO:
+      PacketProcessor_LOGE("size can not be zero!");
+      break;
+    case LengthStatus::TOO_BIG:
+      PacketProcessor_LOGW("size too big, or data error, restart!");
+      break;
+    case LengthStatus::CRC_ERROR:
+      PacketProcessor_LOGE("size crc error");
+      break;
+    case LengthStatus::BAD_ENCODING:
+      PacketProcessor_LOGE("size encoding error");
+      break;
+    default:
+      break;
+  }
+}
+
+/**
+ * 解析长度及长度校验
+ * @param p 指向包头 需已确认包头有效
+ * @param avail 可用字节数
+ * @param size 数据净长度
+ * @param compressed 数据已压缩
+ * @param dataPos 数据相对包头的位置
+ */
+PacketProcessor::LengthStatus PacketProcessor::parseLength(const uint8_t* p, size_t avail, uint32_t* size, bool* compressed,
+                                                           size_t* dataPos) const {
+  if (p[1] == H_2) {
+    if (avail < HEADER_LEN + LEN_BYTES) return LengthStatus::NEED_MORE;
+    p += HEADER_LEN;
+    const uint32_t rawSize = readU32(p);
+    *compressed = rawSize & COMPRESS_FLAG;
+    *size = rawSize & ~COMPRESS_FLAG;
+    *dataPos = HEADER_LEN + LEN_BYTES;
+
+    if (*size == 0) return LengthStatus::ZERO;
+    if (*size > maxBufferSize_) return LengthStatus::TOO_BIG;
+
+    uint16_t expectSizeCrc = readU16(p + LEN_BYTES - LEN_CRC_B);
+    uint16_t sizeCrc = calCrc<uint32_t>(rawSize);
+    PacketProcessor_LOGV("length crc: 0x%02X  0x%02X", sizeCrc, expectSizeCrc);
+    if (sizeCrc != expectSizeCrc) return LengthStatus::CRC_ERROR;
+    return LengthStatus::OK;
+  }
+
+  // 紧凑形式
+  assert(p[1] == H_2_COMPACT);
+  uint64_t v = 0;
+  size_t n = 0;
+  for (;;) {
+    if (n == COMPACT_LEN_MAX) return LengthStatus::TOO_BIG;
+    if (HEADER_LEN + n >= avail) return LengthStatus::NEED_MORE;
+    uint8_t b = p[HEADER_LEN + n];
+    v |= (uint64_t)(b & 0x7f) << 7 * n;
+    n++;
+    if (!(b & 0x80)) {
+      // 每个长度只有一种编码: 多字节时最后一字节不能为0
+      if (n > 1 && b == 0) return LengthStatus::BAD_ENCODING;
+      break;
+    }
+  }
+  if (HEADER_LEN + n + COMPACT_LEN_CHECK > avail) return LengthStatus::NEED_MORE;
+
+  *compressed = v & 1;
+  v >>= 1;
+  *dataPos = HEADER_LEN + n + COMPACT_LEN_CHECK;
+  if (v == 0) return LengthStatus::ZERO;
+  if (v > COMPACT_MAX_SIZE || v > maxBufferSize_) return LengthStatus::TOO_BIG;
+  *size = (uint32_t)v;
+
+  uint8_t expectSizeCrc = p[HEADER_LEN + n];
+  uint8_t sizeCrc = crc_16(p + HEADER_LEN, n) & 0xff;
+  PacketProcessor_LOGV("length crc: 0x%02X  0x%02X", sizeCrc, expectSizeCrc);
+  if (sizeCrc != expectSizeCrc) return LengthStatus::CRC_ERROR;
+  return LengthStatus::OK;
+}
+
+uint16_t PacketProcessor::calDataCrc(const uint8_t* data, uint32_t size) const {
+  if (not useCrc_) return ~calCrc(size);
+#ifdef PacketProcessor_WITH_PARALLEL_CRC
+  if (parallelCrcThreshold_ != 0 && size >= parallelCrcThreshold_) {
+    return PacketCrcPool::instance().crc16(data, size);
+  }
+#endif
+  return crc_16(data, size);
+}
+
 bool PacketProcessor::checkCrc() {
   uint8_t* buffer = buffer_.data();
 
@@ -247,11 +756,8 @@ bool PacketProcessor::checkCrc() {
   uint32_t dataSize = getDataSize();
   uint8_t* crcPos = dataPos + dataSize;
 
-  uint16_t expectDataCrc = useCrc_ ? crc_16(dataPos, dataSize) : ~calCrc(dataSize);
-  uint16_t dataCrc = 0;
-  FOR(i, CHECK_LEN) {
-    dataCrc += (decltype(dataCrc))(crcPos[i]) << 8u * (CHECK_LEN - 1 - i);
-  }
+  uint16_t expectDataCrc = calDataCrc(dataPos, dataSize);
+  uint16_t dataCrc = readU16(crcPos);
   bool ret = dataCrc == expectDataCrc;
   if (not ret) {
     PacketProcessor_LOGE("data crc error: 0x%02X != 0x%02X", dataCrc, expectDataCrc);
@@ -259,18 +765,69 @@ bool PacketProcessor::checkCrc() {
   return dataCrc == expectDataCrc;
 }
 
+void PacketProcessor::onPacket(uint8_t* data, size_t size) {
+  if (rawPacketHandle_) {
+    rawPacketHandle_(rawPacketHandleCtx_, data, size);
+  } else if (onPacketHandle_) {
+    onPacketHandle_(data, size);
+  }
+}
+
+void PacketProcessor::handlePacket() {
+  deliver(getPayloadPtr(), getDataSize(), compressed_);
+}
+
+void PacketProcessor::deliver(uint8_t* data, size_t dataSize, bool compressed) {
+  if (not onPacketHandle_ && not rawPacketHandle_) return;
+
+  if (not compressed) {
+    onPacket(data, dataSize);
+    return;
+  }
+
+#ifdef PacketProcessor_DISABLE_COMPRESS
+  PacketProcessor_LOGE("compress disabled, drop compressed data: %zu", dataSize);
+#else
+  if (dataSize <= COMPRESS_SIZE_LEN) {
+    PacketProcessor_LOGE("compressed data too short: %zu", dataSize);
+    return;
+  }
+  uint32_t originSize = 0;
+  FOR(i, COMPRESS_SIZE_LEN) {
+    originSize += (uint32_t)data[i] << (COMPRESS_SIZE_LEN - i - 1) * 8;
+  }
+  if (originSize == 0 || originSize > maxBufferSize_) {
+    PacketProcessor_LOGE("decompress size error: %u", originSize);
+    return;
+  }
+
+  if (unpackBuffer_.size() < originSize && !unpackBuffer_.resize(originSize)) {
+    PacketProcessor_LOGE("decompress buffer too small: %zu < %u", unpackBuffer_.capacity(), originSize);
+    return;
+  }
+  size_t size = lz_decompress(data + COMPRESS_SIZE_LEN, dataSize - COMPRESS_SIZE_LEN, unpackBuffer_.data(), originSize);
+  if (size != originSize) {
+    PacketProcessor_LOGE("decompress error: %zu != %u", size, originSize);
+    return;
+  }
+  onPacket(unpackBuffer_.data(), size);
+#endif
+}
+
 size_t PacketProcessor::getNextPacketPos() {
-  return getDataPos() + dataSize_ + CHECK_LEN;
+  return dataPos_ + dataSize_ + CHECK_LEN;
 }
 
 void PacketProcessor::restart(uint32_t pos) {
   PacketProcessor_LOGV("restart: pos=%u,  buffer_.size()=%zu", pos, buffer_.size());
   assert(buffer_.size() >= pos);
 
-  buffer_.assign(buffer_.cbegin() + pos, buffer_.cend());
+  buffer_.eraseFront(pos);
 
   findHeader_ = false;
   dataSize_ = 0;
+  compressed_ = false;
+  partialSince_ = Clock::time_point();
 
   // 每次解包成功后 要继续尝试解包 因为缓冲可能包含多个包
   tryUnpack();
@@ -1,47 +1,186 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#else
+struct iovec {
+  void* iov_base;
+  size_t iov_len;
+};
+#endif
+
 class PacketProcessor {
   using OnPacketHandle = std::function<void(uint8_t* data, size_t size)>;
 
+ public:
+  using Clock = std::chrono::steady_clock;
+  using RawPacketHandle = void (*)(void* ctx, uint8_t* data, size_t size);
+
+  static const unsigned int HEADROOM = 8;  // 原地打包时数据前预留的字节数
+  static const unsigned int TAILROOM = 2;  // 原地打包时数据后预留的字节数
+  static const uint32_t MAX_DATA_SIZE = 0x7FFFFFFF;  // 数据净长度上限 长度最高位用作压缩标志
+  static const uint32_t COMPACT_MAX_SIZE = 8191;      // 紧凑包头的数据净长度上限 varint最多2字节
+
  public:
   explicit PacketProcessor(OnPacketHandle handle = nullptr, bool useCrc = false);
 
  public:
   void setOnPacketHandle(const OnPacketHandle& handle);
 
+  /**
+   * 设置函数指针形式的回调 不依赖std::function
+   * @param handle
+   * @param ctx 回调的第一个参数
+   */
+  void setOnPacketHandle(RawPacketHandle handle, void* ctx);
+
   /**
    * 设置对数据是否启用CRC 否则对数据长度CRC
    * @param useCrc
    */
   void setUseCrc(bool useCrc);
 
+  /**
+   * 设置打包时是否使用紧凑包头(varint长度+1字节长度校验) 适合很小的数据包
+   * 数据净长度超过COMPACT_MAX_SIZE时仍使用约定形式 启用时同时setAcceptCompactHeader(true)
+   * @param useCompactHeader
+   */
+  void setUseCompactHeader(bool useCompactHeader);
+
+  /**
+   * 设置解包时是否识别紧凑包头 默认只识别约定形式
+   * 紧凑包头的长度校验只有8位 只接收约定形式时不启用 以保持失步后重新同步的可靠性
+   * @param acceptCompactHeader
+   */
+  void setAcceptCompactHeader(bool acceptCompactHeader);
+
+  /**
+   * 设置打包时是否尝试压缩数据 仅当压缩后更小时才使用压缩
+   * 解包时总是自动识别并解压 无需设置
+   * 定义PacketProcessor_DISABLE_COMPRESS(CMake选项PacketProcessor_WITH_COMPRESS=OFF)时不链接压缩代码 此设置无效 收到的压缩数据包被丢弃
+   * @param useCompress
+   */
+  void setUseCompress(bool useCompress);
+
+  /**
+   * 开启数据CRC时 数据长度不小于此值则切分到线程池并行计算CRC 结果与串行相同 默认1MBytes 为0时不并行
+   * 需编译PacketCrcPool(PacketProcessor_WITH_PARALLEL_CRC) 否则总是串行
+   * @param size
+   */
+  void setParallelCrcThreshold(size_t size);
+
   void setMaxBufferSize(uint32_t size);
 
+  /**
+   * 使用外部内存作为解包缓存 之后解包不再分配内存 最大缓存字节数为size
+   * @param buffer
+   * @param size 需不小于最大数据包总长度
+   * @param scratch 可选 解压缓存 不提供时丢弃压缩的数据包
+   * @param scratchSize 需不小于压缩前的数据长度
+   */
+  void setBuffer(uint8_t* buffer, size_t size, uint8_t* scratch = nullptr, size_t scratchSize = 0);
+
+  /**
+   * 释放缓存
+   */
   void clearBuffer();
 
   /**
-   * 打包数据
+   * @return 缓存占用的内存字节数(包括解包和解压缓存)
+   */
+  size_t bufferCapacity() const;
+
+  /**
+   * @return evict/trim最多可释放的缓存字节数 外部内存(setBuffer)不计入
+   */
+  size_t releasableCapacity() const;
+
+  /**
+   * 未完成数据包没有新数据到达的最长时间 超时后由poll丢弃 为0时不超时(默认)
+   * 从最后一次收到数据时计时 持续到达的大数据包不会超时
+   * @param timeout
+   */
+  void setPartialTimeout(Clock::duration timeout);
+
+  /**
+   * 检查未完成数据包是否超时 超时则丢弃 用于在没有新数据时由事件循环定时调用
+   * @param now
+   * @return 是否丢弃了数据
+   */
+  bool poll(Clock::time_point now = Clock::now());
+
+  /**
+   * 丢弃未完成的数据包并释放缓存 计入evictions
+   * @return 是否丢弃了数据
+   */
+  bool evict();
+
+  /**
+   * 释放空闲的缓存 不丢弃数据
+   */
+  void trim();
+
+  /**
+   * @return 缓存中等待解包的字节数
+   */
+  size_t pendingSize() const;
+
+  /**
+   * @return 当前未完成数据包最后一次收到数据的时间 没有时返回Clock::time_point()
+   */
+  Clock::time_point partialSince() const;
+
+  /**
+   * @return 因超时或内存不足丢弃未完成数据包的次数
+   */
+  uint64_t evictions() const;
+
+  /**
+   * 打包数据 可多线程同时调用
    * @param data 视为uint8_t*
-   * @param size
-   * @return
+   * @param size 不可超过MAX_DATA_SIZE
+   * @return 数据过长时返回空
    */
   std::string pack(const void* data, uint32_t size) const;
 
   std::string pack(const std::string& data) const;
 
   /**
-   * 遍历打包数据
+   * 遍历打包数据 可多线程同时调用
    * @param data 视为uint8_t*
-   * @param size
+   * @param size 不可超过MAX_DATA_SIZE 否则不回调
    * @param handle
    */
   void packForeach(const void* data, uint32_t size, const std::function<void(uint8_t* data, size_t size)>& handle) const;
 
+  /**
+   * 原地打包 避免数据拷贝
+   * buffer前HEADROOM字节预留给包头 数据已写入buffer+HEADROOM 其后需预留TAILROOM字节给校验
+   * 不会压缩数据 未开启压缩时输出与pack()逐字节相同
+   * @param buffer
+   * @param size 数据净长度 不可超过MAX_DATA_SIZE
+   * @param frameSize 输出数据包总长度
+   * @return 数据包起始位置 紧凑包头时位于buffer之后 数据过长时返回nullptr
+   */
+  uint8_t* packInPlace(uint8_t* buffer, uint32_t size, size_t* frameSize) const;
+
+  /**
+   * 打包到调用者提供的内存 不分配内存 输出与pack()逐字节相同
+   * @param data 视为uint8_t*
+   * @param size
+   * @param out
+   * @param capacity 需不小于size+10
+   * @return 数据包总长度 空间不足或数据过长时返回0
+   */
+  size_t packTo(const void* data, uint32_t size, void* out, size_t capacity) const;
+
   /**
    * 送数据 自动解析出数据包时回调onPacketHandle_
    * @param data
@@ -49,7 +188,118 @@ class PacketProcessor {
    */
   void feed(const void* data, size_t size);
 
+  /**
+   * 一次送入多段数据 解包结果与依次feed每段相同
+   * 完整位于某一段内的数据包直接从该段回调 不拷贝; 跨越多段的数据包只缓存其自身的字节
+   * 不同于feed: 单段超过最大缓存字节数时不会整段丢弃
+   * @param iov
+   * @param count
+   */
+  void feedv(const struct iovec* iov, size_t count);
+
+  /**
+   * 检查data起始处是否为一个完整有效的数据包(包头、长度校验、数据校验)
+   * 不改变解包状态 可用于扫描已记录的数据流
+   * @param data
+   * @param size 可用字节数
+   * @param payload 可选 输出数据位置
+   * @param payloadSize 可选 输出数据净长度
+   * @param incomplete 可选 输出是否为有效的包头但数据不足 需要更多数据才能判断
+   * @return 数据包总长度 无效或不完整时返回0
+   */
+  size_t checkPacket(const void* data, size_t size, const uint8_t** payload = nullptr, size_t* payloadSize = nullptr,
+                     bool* incomplete = nullptr) const;
+
  private:
+  /**
+   * 字节缓存 默认在堆上按需扩容 setExternal后使用外部内存且不再分配
+   */
+  class Buffer {
+   public:
+    Buffer() = default;
+    Buffer(const Buffer& other);
+    Buffer& operator=(const Buffer& other);
+
+   public:
+    void setExternal(uint8_t* data, size_t capacity);
+
+    bool isExternal() const {
+      return external_;
+    }
+
+    uint8_t* data() {
+      return data_;
+    }
+
+    size_t size() const {
+      return size_;
+    }
+
+    bool empty() const {
+      return size_ == 0;
+    }
+
+    size_t capacity() const {
+      return capacity_;
+    }
+
+    uint8_t& operator[](size_t i) {
+      return data_[i];
+    }
+
+    /**
+     * @return 外部内存容量不足时返回false
+     */
+    bool reserve(size_t capacity);
+
+    bool resize(size_t size);
+
+    bool append(const uint8_t* data, size_t size);
+
+    void eraseFront(size_t size);
+
+    void clear() {
+      size_ = 0;
+    }
+
+    /**
+     * 清空 并释放堆内存
+     */
+    void release();
+
+   private:
+    std::unique_ptr<uint8_t[]> heap_;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    bool external_ = false;
+  };
+
+  enum class LengthStatus {
+    OK,
+    NEED_MORE,
+    ZERO,
+    TOO_BIG,
+    CRC_ERROR,
+    BAD_ENCODING,
+  };
+
+  bool isSync2(uint8_t b) const {
+    return b == H_2 || (acceptCompactHeader_ && b == H_2_COMPACT);
+  }
+
+  static void packClassicHeader(uint8_t* header, uint32_t dataSize);
+
+  static size_t packCompactHeader(uint8_t* header, uint32_t size, bool compressed);
+
+  uint8_t* packInPlace(uint8_t* buffer, uint32_t size, bool compressed, size_t* frameSize) const;
+
+  void onPacket(uint8_t* data, size_t size);
+
+  LengthStatus parseLength(const uint8_t* p, size_t avail, uint32_t* size, bool* compressed, size_t* dataPos) const;
+
+  uint16_t calDataCrc(const uint8_t* data, uint32_t size) const;
+
   size_t getDataPos();
 
   size_t getDataSize();
@@ -60,15 +310,33 @@ class PacketProcessor {
 
   void tryUnpack();
 
+  size_t unpackDirect(uint8_t* data, size_t size);
+
+  size_t bufferNeed();
+
+  bool appendBuffer(const uint8_t* data, size_t size, size_t reserveSize);
+
+  static void logLengthError(LengthStatus status);
+
   bool checkCrc();
 
+  void handlePacket();
+
+  void deliver(uint8_t* data, size_t size, bool compressed);
+
   size_t getNextPacketPos();
 
   void restart(uint32_t pos);
 
  private:
   OnPacketHandle onPacketHandle_;
+  RawPacketHandle rawPacketHandle_ = nullptr;
+  void* rawPacketHandleCtx_ = nullptr;
   bool useCrc_;
+  bool useCompress_ = false;
+  bool useCompactHeader_ = false;
+  bool acceptCompactHeader_ = false;
+  size_t parallelCrcThreshold_ = 1024 * 1024;
 
   static const uint8_t H_1 = 0x5A;
   static const uint8_t H_2 = 0xA5;
@@ -77,9 +345,54 @@ class PacketProcessor {
   static const unsigned int LEN_BYTES = 4 + LEN_CRC_B;
   static const unsigned int CHECK_LEN = 2;
   static const unsigned int ALL_HEADER_LEN = HEADER_LEN + LEN_BYTES + CHECK_LEN;
+  static const uint8_t H_2_COMPACT = 0xC3;           // 紧凑包头
+  static const unsigned int COMPACT_LEN_MAX = 2;     // varint长度最大字节数
+  static const unsigned int COMPACT_LEN_CHECK = 1;   // 紧凑长度校验字节数
+  static const uint32_t COMPRESS_FLAG = 0x80000000;  // 长度最高位: 数据已压缩
+  static const unsigned int COMPRESS_SIZE_LEN = 4;   // 压缩数据前的原始长度(大端序)
+  static const unsigned int COMPRESS_MIN_SIZE = 64;  // 小于此长度不尝试压缩
 
-  std::vector<uint8_t> buffer_;               // 数据缓存
+  static_assert(HEADROOM == HEADER_LEN + LEN_BYTES, "HEADROOM must equal the classic header");
+  static_assert(HEADROOM >= HEADER_LEN + COMPACT_LEN_MAX + COMPACT_LEN_CHECK, "HEADROOM must fit the compact header");
+  static_assert(TAILROOM == CHECK_LEN, "TAILROOM must equal the check");
+  static_assert(((uint64_t)COMPACT_MAX_SIZE << 1 | 1) < 1ull << 7 * COMPACT_LEN_MAX, "COMPACT_MAX_SIZE must fit the varint");
+
+  Buffer buffer_;                             // 数据缓存
   uint32_t maxBufferSize_ = 1024 * 1024 * 1;  // 最大缓存字节数 默认1MBytes
   bool findHeader_ = false;                   // 找到包头
   size_t dataSize_ = 0;                       // 解析出的数据净长度
+  size_t dataPos_ = 0;                        // 数据相对包头的位置
+  bool compressed_ = false;                   // 当前包数据已压缩
+  Clock::time_point partialSince_;            // 未完成数据包最后一次收到数据的时间
+  Clock::duration partialTimeout_{0};         // 未完成数据包超时 为0时不超时
+  uint64_t evictions_ = 0;                    // 丢弃未完成数据包的次数
+
+#ifdef PacketProcessor_ENABLE_TRACE
+  uint64_t traceHeader_ = 0;    // 找到包头的时刻
+  uint64_t traceLength_ = 0;    // 长度校验通过的时刻
+  uint64_t traceComplete_ = 0;  // 数据全部到达的时刻
+#endif
+
+  Buffer unpackBuffer_;  // 解压缓存 复用以避免每包分配
+};
+
+/**
+ * 编译期指定缓存大小的PacketProcessor 解包和packTo/packInPlace均不使用堆内存
+ * @tparam BufferSize 解包缓存大小 需不小于最大数据包总长度
+ * @tparam ScratchSize 解压缓存大小 为0时丢弃压缩的数据包
+ */
+template <size_t BufferSize, size_t ScratchSize = 0>
+class StaticPacketProcessor : public PacketProcessor {
+ public:
+  explicit StaticPacketProcessor(RawPacketHandle handle = nullptr, void* ctx = nullptr, bool useCrc = false) : PacketProcessor(nullptr, useCrc) {
+    setOnPacketHandle(handle, ctx);
+    setBuffer(storage_, BufferSize, ScratchSize ? scratch_ : nullptr, ScratchSize);
+  }
+
+  StaticPacketProcessor(const StaticPacketProcessor&) = delete;
+  StaticPacketProcessor& operator=(const StaticPacketProcessor&) = delete;
+
+ private:
+  uint8_t storage_[BufferSize];
+  uint8_t scratch_[ScratchSize ? ScratchSize : 1];
 };
@@ -0,0 +1,53 @@
+#include "PacketRouter.h"
+
+// #define PacketProcessor_LOG_SHOW_VERBOSE
+#include "log.h"
+
+PacketRouter::PacketRouter() {
+  for (auto& e : table_) {
+    e = {nullptr, nullptr};
+  }
+  fallback_ = {nullptr, nullptr};
+}
+
+void PacketRouter::route(uint8_t type, Handler handler, void* ctx) {
+  table_[type] = {handler, ctx};
+}
+
+void PacketRouter::setFallback(Handler handler, void* ctx) {
+  fallback_ = {handler, ctx};
+}
+
+void PacketRouter::dispatch(const uint8_t* data, size_t size) {
+  if (size == 0) {
+    dropped_++;
+    return;
+  }
+
+  const Entry& e = table_[data[0]];
+  const MessageView view(data + 1, size - 1);
+  if (e.handler) {
+    e.handler(e.ctx, view);
+  } else if (fallback_.handler) {
+    fallback_.handler(fallback_.ctx, MessageView(data, size));
+  } else {
+    PacketProcessor_LOGV("no route for type: %u", data[0]);
+    dropped_++;
+  }
+}
+
+void PacketRouter::attach(PacketProcessor& processor) {
+  processor.setOnPacketHandle(&PacketRouter::onPacket, this);
+}
+
+void PacketRouter::onPacket(void* ctx, uint8_t* data, size_t size) {
+  static_cast<PacketRouter*>(ctx)->dispatch(data, size);
+}
+
+uint64_t PacketRouter::dropped() const {
+  return dropped_;
+}
+
+uint64_t PacketRouter::malformed() const {
+  return malformed_;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "PacketProcessor.h"
+
+/**
+ * 数据包内一段数据的只读视图 不拷贝数据 所有访问均做边界检查
+ */
+class MessageView {
+ public:
+  MessageView(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+ public:
+  const uint8_t* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  /**
+   * 零拷贝访问 要求数据地址满足T的对齐
+   * PacketProcessor回调的数据位于包头之后 去掉类型字节后通常为奇数地址 对齐要求大于1的T几乎总是返回nullptr
+   * 此时用read拷贝读取 或将消息定义为1字节对齐(#pragma pack(1))
+   * @return 越界或未对齐时返回nullptr
+   */
+  template <typename T>
+  const T* as(size_t offset = 0) const {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+    if (offset > size_ || size_ - offset < sizeof(T)) return nullptr;
+    const uint8_t* p = data_ + offset;
+    if ((uintptr_t)p % alignof(T) != 0) return nullptr;
+    return reinterpret_cast<const T*>(p);
+  }
+
+  /**
+   * 拷贝读取 不要求对齐
+   * @return 越界时返回false
+   */
+  template <typename T>
+  bool read(T& out, size_t offset = 0) const {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+    if (offset > size_ || size_ - offset < sizeof(T)) return false;
+    memcpy(&out, data_ + offset, sizeof(T));
+    return true;
+  }
+
+  /**
+   * @return 从offset开始的子视图 越界部分被截断
+   */
+  MessageView sub(size_t offset, size_t size = (size_t)-1) const {
+    if (offset > size_) offset = size_;
+    if (size > size_ - offset) size = size_ - offset;
+    return {data_ + offset, size};
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+};
+
+/**
+ * 按数据首字节(消息类型)分发数据包 分发表为256项的平坦数组 回调为函数指针+上下文
+ * 回调收到的视图不含类型字节 仅在回调期间有效
+ */
+class PacketRouter {
+ public:
+  using Handler = void (*)(void* ctx, MessageView view);
+
+ public:
+  PacketRouter();
+
+  PacketRouter(const PacketRouter&) = delete;
+  PacketRouter& operator=(const PacketRouter&) = delete;
+
+ public:
+  /**
+   * 运行时注册
+   * @param type
+   * @param handler 为nullptr时取消注册
+   * @param ctx
+   */
+  void route(uint8_t type, Handler handler, void* ctx = nullptr);
+
+  /**
+   * 编译期注册函数: void fn(MessageView)
+   */
+  template <void (*Fn)(MessageView)>
+  void route(uint8_t type) {
+    route(type, [](void*, MessageView view) {
+      Fn(view);
+    });
+  }
+
+  /**
+   * 编译期注册成员函数: void C::fn(MessageView)
+   */
+  template <typename C, void (C::*Fn)(MessageView)>
+  void route(uint8_t type, C* obj) {
+    route(
+        type,
+        [](void* ctx, MessageView view) {
+          (static_cast<C*>(ctx)->*Fn)(view);
+        },
+        obj);
+  }
+
+  /**
+   * 编译期注册定长消息: void fn(const T& msg, MessageView tail)
+   * 数据不足sizeof(T)时计入malformed 对齐时零拷贝 否则拷贝到栈上(见MessageView::as 1字节对齐的T总是零拷贝)
+   */
+  template <typename T, void (*Fn)(const T&, MessageView)>
+  void route(uint8_t type) {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+    route(
+        type,
+        [](void* ctx, MessageView view) {
+          auto self = static_cast<PacketRouter*>(ctx);
+          if (view.size() < sizeof(T)) {
+            self->malformed_++;
+            return;
+          }
+          const MessageView tail = view.sub(sizeof(T));
+          if (const T* msg = view.as<T>()) {
+            Fn(*msg, tail);
+          } else {
+            T tmp;
+            view.read(tmp);
+            Fn(tmp, tail);
+          }
+        },
+        this);
+  }
+
+  /**
+   * 未注册类型的回调 收到的视图包含类型字节 默认丢弃并计入dropped
+   */
+  void setFallback(Handler handler, void* ctx = nullptr);
+
+  void dispatch(const uint8_t* data, size_t size);
+
+  /**
+   * 设置为processor的回调 使用函数指针形式 不经过std::function
+   */
+  void attach(PacketProcessor& processor);
+
+  uint64_t dropped() const;
+
+  uint64_t malformed() const;
+
+ private:
+  static void onPacket(void* ctx, uint8_t* data, size_t size);
+
+  struct Entry {
+    Handler handler;
+    void* ctx;
+  };
+
+  Entry table_[256];
+  Entry fallback_;
+  uint64_t dropped_ = 0;    // 空包或未注册类型
+  uint64_t malformed_ = 0;  // 长度不足
+};
@@ -0,0 +1,368 @@
+#include "PacketShmRing.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <new>
+
+// #define PacketProcessor_LOG_SHOW_VERBOSE
+#include "log.h"
+
+static const uint32_t SHM_MAGIC = 0x50505352;  // "PPSR"
+static const uint32_t SHM_VERSION = 1;
+static const unsigned int FRAME_OVERHEAD = PacketProcessor::HEADROOM + PacketProcessor::TAILROOM;
+static const int SPIN_COUNT = 200;  // 进入futex等待前的自旋次数
+
+/**
+ * 位于共享内存第一页 读写位置各占一个缓存行 避免两端互相失效
+ * 位置为累计字节数 对capacity取模得到数据区偏移
+ */
+struct PacketShmRing::Header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  uint32_t useCrc;
+
+  alignas(64) std::atomic<uint64_t> head;    // 写入位置 只由写入端修改
+  std::atomic<uint32_t> writerWaiting;       // 写入端等待空间
+  std::atomic<uint32_t> spaceSeq;            // 写入端的futex
+  alignas(64) std::atomic<uint64_t> tail;    // 读取位置 只由读取端修改
+  std::atomic<uint32_t> readerWaiting;       // 读取端等待数据
+  std::atomic<uint32_t> dataSeq;             // 读取端的futex
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "position must be lock free");
+
+static void futexWait(std::atomic<uint32_t>* word, uint32_t expect, int timeoutMs) {
+  timespec ts;
+  timespec* timeout = nullptr;
+  if (timeoutMs >= 0) {
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+    timeout = &ts;
+  }
+  // 跨进程 不能使用FUTEX_PRIVATE_FLAG
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expect, timeout, nullptr, 0);
+}
+
+static void futexWake(std::atomic<uint32_t>* word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+/**
+ * @return 剩余等待时间 已超时返回0 timeoutMs为负时返回-1
+ */
+static int remainMs(std::chrono::steady_clock::time_point deadline, int timeoutMs) {
+  if (timeoutMs < 0) return -1;
+  auto remain = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+  return remain > 0 ? (int)remain : 0;
+}
+
+PacketShmRing::~PacketShmRing() {
+  close();
+}
+
+bool PacketShmRing::create(const std::string& name, size_t capacity, bool useCrc) {
+  close();
+
+  const size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = page;
+  while (size < capacity) size <<= 1;
+
+  ::shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    PacketProcessor_LOGE("shm_open failed: %s, %s", name.c_str(), strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, page + size) != 0) {
+    PacketProcessor_LOGE("ftruncate failed: %s, %s", name.c_str(), strerror(errno));
+    ::close(fd);
+    ::shm_unlink(name.c_str());
+    return false;
+  }
+  const bool ok = map(fd, size);
+  ::close(fd);
+  if (not ok) {
+    ::shm_unlink(name.c_str());
+    return false;
+  }
+
+  header_ = new (base_) Header();
+  header_->magic = SHM_MAGIC;
+  header_->version = SHM_VERSION;
+  header_->capacity = size;
+  header_->useCrc = useCrc;
+  header_->head.store(0, std::memory_order_relaxed);
+  header_->tail.store(0, std::memory_order_relaxed);
+  header_->writerWaiting.store(0, std::memory_order_relaxed);
+  header_->readerWaiting.store(0, std::memory_order_relaxed);
+  header_->spaceSeq.store(0, std::memory_order_relaxed);
+  header_->dataSeq.store(0, std::memory_order_release);
+  processor_.setUseCrc(useCrc);
+  return true;
+}
+
+bool PacketShmRing::open(const std::string& name) {
+  close();
+
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0) {
+    PacketProcessor_LOGE("shm_open failed: %s, %s", name.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st;
+  const size_t page = sysconf(_SC_PAGESIZE);
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size <= page) {
+    PacketProcessor_LOGE("shm size error: %s", name.c_str());
+    ::close(fd);
+    return false;
+  }
+  const bool ok = map(fd, st.st_size - page);
+  ::close(fd);
+  if (not ok) return false;
+
+  header_ = reinterpret_cast<Header*>(base_);
+  if (header_->magic != SHM_MAGIC || header_->version != SHM_VERSION || header_->capacity != capacity_) {
+    PacketProcessor_LOGE("shm header error: %s", name.c_str());
+    close();
+    return false;
+  }
+  processor_.setUseCrc(header_->useCrc);
+  return true;
+}
+
+void PacketShmRing::unlink(const std::string& name) {
+  ::shm_unlink(name.c_str());
+}
+
+/**
+ * 保留连续的地址空间 映射Header页后将数据区映射两次
+ */
+bool PacketShmRing::map(int fd, size_t capacity) {
+  const size_t page = sysconf(_SC_PAGESIZE);
+  const size_t mapSize = page + capacity * 2;
+  void* base = mmap(nullptr, mapSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    PacketProcessor_LOGE("mmap failed: %s", strerror(errno));
+    return false;
+  }
+  auto p = (uint8_t*)base;
+  if (mmap(p, page + capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+      mmap(p + page + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, page) == MAP_FAILED) {
+    PacketProcessor_LOGE("mmap failed: %s", strerror(errno));
+    munmap(base, mapSize);
+    return false;
+  }
+
+  static_assert(sizeof(Header) <= 4096, "Header must fit in a page");
+  base_ = p;
+  mapSize_ = mapSize;
+  data_ = p + page;
+  capacity_ = capacity;
+  processor_.setMaxBufferSize((uint32_t)std::min<size_t>(capacity - FRAME_OVERHEAD, UINT32_MAX - FRAME_OVERHEAD));
+  return true;
+}
+
+void PacketShmRing::close() {
+  if (base_) munmap(base_, mapSize_);
+  base_ = nullptr;
+  mapSize_ = 0;
+  header_ = nullptr;
+  data_ = nullptr;
+  capacity_ = 0;
+  peekSize_ = 0;
+}
+
+bool PacketShmRing::valid() const {
+  return header_ != nullptr;
+}
+
+size_t PacketShmRing::capacity() const {
+  return capacity_;
+}
+
+size_t PacketShmRing::maxPacketSize() const {
+  return capacity_ > FRAME_OVERHEAD ? capacity_ - FRAME_OVERHEAD : 0;
+}
+
+bool PacketShmRing::write(const void* data, uint32_t size, int timeoutMs) {
+  if (not valid()) return false;
+  // 长度为0的数据包不是有效的帧 读取端会当作环被破坏而丢弃全部数据
+  if (size == 0) {
+    PacketProcessor_LOGE("empty packet");
+    return false;
+  }
+  const size_t need = (size_t)size + FRAME_OVERHEAD;
+  if (need > capacity_) {
+    PacketProcessor_LOGE("packet too big: %u, max: %zu", size, maxPacketSize());
+    return false;
+  }
+
+  const uint64_t head = header_->head.load(std::memory_order_relaxed);
+  if (capacity_ - (head - header_->tail.load(std::memory_order_acquire)) < need && not waitSpace(head, need, timeoutMs)) {
+    return false;
+  }
+
+  // 数据区映射了两次 跨越环尾时仍可连续写入
+  const size_t frameSize = processor_.packTo(data, size, data_ + (head & (capacity_ - 1)), need);
+  header_->head.store(head + frameSize, std::memory_order_release);
+  stats_.frames++;
+  stats_.bytes += size;
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (header_->readerWaiting.load(std::memory_order_relaxed)) {
+    header_->dataSeq.fetch_add(1, std::memory_order_release);
+    futexWake(&header_->dataSeq);
+    stats_.wakeups++;
+  }
+  return true;
+}
+
+size_t PacketShmRing::poll(const OnPacketHandle& handle, int timeoutMs) {
+  if (not valid()) return 0;
+
+  uint64_t tail = header_->tail.load(std::memory_order_relaxed) + peekSize_;
+  peekSize_ = 0;
+  uint64_t head = header_->head.load(std::memory_order_acquire);
+  if (head == tail) {
+    if (not waitData(tail, timeoutMs)) {
+      commitTail(tail);
+      return 0;
+    }
+    head = header_->head.load(std::memory_order_acquire);
+  }
+
+  size_t count = 0;
+  const uint8_t* payload;
+  size_t payloadSize;
+  while (tail != head) {
+    const size_t frameSize = nextPacket(tail, head, &payload, &payloadSize);
+    if (frameSize == 0) {
+      tail = head;
+      break;
+    }
+    handle(payload, payloadSize);
+    tail += frameSize;
+    count++;
+  }
+  commitTail(tail);
+  return count;
+}
+
+const uint8_t* PacketShmRing::peek(size_t* size) {
+  if (not valid() || peekSize_ != 0) return nullptr;
+
+  const uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+  const uint64_t head = header_->head.load(std::memory_order_acquire);
+  const uint8_t* payload;
+  peekSize_ = nextPacket(tail, head, &payload, size);
+  if (peekSize_ == 0) {
+    // 没有数据或数据无效
+    commitTail(head);
+    return nullptr;
+  }
+  return payload;
+}
+
+void PacketShmRing::release() {
+  if (peekSize_ == 0) return;
+  commitTail(header_->tail.load(std::memory_order_relaxed) + peekSize_);
+  peekSize_ = 0;
+}
+
+size_t PacketShmRing::nextPacket(uint64_t tail, uint64_t head, const uint8_t** payload, size_t* payloadSize) {
+  if (head == tail) return 0;
+  if (head - tail > capacity_) {
+    // 写入端不会超过容量 说明读写位置被破坏 不能越过两次映射的数据区读取
+    PacketProcessor_LOGE("ring corrupted, head: %llu, tail: %llu", (unsigned long long)head, (unsigned long long)tail);
+    stats_.errors++;
+    return 0;
+  }
+  const size_t frameSize = processor_.checkPacket(data_ + (tail & (capacity_ - 1)), head - tail, payload, payloadSize);
+  if (frameSize == 0) {
+    // 写入端总是写入完整的数据包 校验失败说明共享内存被破坏
+    PacketProcessor_LOGE("invalid packet in ring, drop: %llu", (unsigned long long)(head - tail));
+    stats_.errors++;
+    return 0;
+  }
+  stats_.frames++;
+  stats_.bytes += *payloadSize;
+  return frameSize;
+}
+
+void PacketShmRing::commitTail(uint64_t tail) {
+  if (tail == header_->tail.load(std::memory_order_relaxed)) return;
+  header_->tail.store(tail, std::memory_order_release);
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (header_->writerWaiting.load(std::memory_order_relaxed)) {
+    header_->spaceSeq.fetch_add(1, std::memory_order_release);
+    futexWake(&header_->spaceSeq);
+    stats_.wakeups++;
+  }
+}
+
+bool PacketShmRing::waitData(uint64_t tail, int timeoutMs) {
+  for (int i = 0; i < SPIN_COUNT; i++) {
+    if (header_->head.load(std::memory_order_acquire) != tail) return true;
+  }
+  if (timeoutMs == 0) return false;
+
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  for (;;) {
+    // 先声明等待再检查 写入端发布数据后检查等待标记 两者不会错过
+    const uint32_t seq = header_->dataSeq.load(std::memory_order_acquire);
+    header_->readerWaiting.store(1, std::memory_order_seq_cst);
+    if (header_->head.load(std::memory_order_seq_cst) != tail) break;
+    const int remain = remainMs(deadline, timeoutMs);
+    if (remain == 0) break;
+    futexWait(&header_->dataSeq, seq, remain);
+    stats_.waits++;
+  }
+  header_->readerWaiting.store(0, std::memory_order_relaxed);
+  return header_->head.load(std::memory_order_acquire) != tail;
+}
+
+bool PacketShmRing::waitSpace(uint64_t head, size_t need, int timeoutMs) {
+  auto hasSpace = [&] {
+    return capacity_ - (head - header_->tail.load(std::memory_order_seq_cst)) >= need;
+  };
+  for (int i = 0; i < SPIN_COUNT; i++) {
+    if (hasSpace()) return true;
+  }
+  if (timeoutMs == 0) return false;
+
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  for (;;) {
+    const uint32_t seq = header_->spaceSeq.load(std::memory_order_acquire);
+    header_->writerWaiting.store(1, std::memory_order_seq_cst);
+    if (hasSpace()) break;
+    const int remain = remainMs(deadline, timeoutMs);
+    if (remain == 0) break;
+    futexWait(&header_->spaceSeq, seq, remain);
+    stats_.waits++;
+  }
+  header_->writerWaiting.store(0, std::memory_order_relaxed);
+  return hasSpace();
+}
+
+size_t PacketShmRing::pendingSize() const {
+  if (not valid()) return 0;
+  return header_->head.load(std::memory_order_acquire) - header_->tail.load(std::memory_order_acquire);
+}
+
+const PacketShmRing::Stats& PacketShmRing::stats() const {
+  return stats_;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "PacketProcessor.h"
+
+/**
+ * 基于POSIX共享内存的单生产者/单消费者无锁环形缓存 用于同一主机上的进程间传递数据包
+ * 环中为PacketProcessor约定形式的数据包 读取端用checkPacket校验 记录或转储环内容的工具无需修改
+ * 数据区在虚拟内存中连续映射两次 跨越环尾的数据包也是连续的 读取端直接获得环内的数据视图 无需拷贝
+ * 一端空闲等待时才通过futex唤醒 不等待时读写均无系统调用
+ * 仅支持Linux 一个环只能有一个写入者和一个读取者
+ */
+class PacketShmRing {
+ public:
+  using OnPacketHandle = std::function<void(const uint8_t* data, size_t size)>;
+
+  struct Stats {
+    uint64_t frames = 0;   // 写入或读取的数据包数
+    uint64_t bytes = 0;    // 写入或读取的数据净长度
+    uint64_t waits = 0;    // 进入futex等待的次数
+    uint64_t wakeups = 0;  // 唤醒对端的次数
+    uint64_t errors = 0;   // 读取到无效数据包的次数
+  };
+
+ public:
+  PacketShmRing() = default;
+
+  ~PacketShmRing();
+
+  PacketShmRing(const PacketShmRing&) = delete;
+  PacketShmRing& operator=(const PacketShmRing&) = delete;
+
+ public:
+  /**
+   * 创建共享内存环 同名的已存在时重新创建
+   * @param name shm_open的名字 如"/packet_ring"
+   * @param capacity 数据区字节数 向上取整为2的幂且不小于内存页
+   * @param useCrc 是否对数据CRC
+   * @return 失败时返回false
+   */
+  bool create(const std::string& name, size_t capacity, bool useCrc = false);
+
+  /**
+   * 打开已创建的共享内存环 配置与创建时相同
+   * @param name
+   * @return 失败时返回false
+   */
+  bool open(const std::string& name);
+
+  /**
+   * 删除共享内存的名字 已打开的映射仍然有效
+   * @param name
+   */
+  static void unlink(const std::string& name);
+
+  bool valid() const;
+
+  size_t capacity() const;
+
+  /**
+   * @return 单个数据包最大净长度
+   */
+  size_t maxPacketSize() const;
+
+  /**
+   * 打包写入
+   * @param data 视为uint8_t*
+   * @param size
+   * @param timeoutMs 空间不足时最长等待时间 为负时一直等待
+   * @return 超时、数据包为空或过大时返回false
+   */
+  bool write(const void* data, uint32_t size, int timeoutMs = -1);
+
+  /**
+   * 回调当前所有可读的数据包 之后统一释放它们占用的空间
+   * 回调收到的数据位于共享内存中 仅在回调期间有效
+   * @param handle
+   * @param timeoutMs 没有数据时最长等待时间 为负时一直等待
+   * @return 回调的数据包数
+   */
+  size_t poll(const OnPacketHandle& handle, int timeoutMs = -1);
+
+  /**
+   * 不等待 获取下一个数据包的视图 需调用release后才能获取下一个
+   * @param size 输出数据净长度
+   * @return 没有数据时返回nullptr
+   */
+  const uint8_t* peek(size_t* size);
+
+  /**
+   * 释放peek获取的数据包
+   */
+  void release();
+
+  /**
+   * @return 已写入未读取的字节数
+   */
+  size_t pendingSize() const;
+
+  const Stats& stats() const;
+
+ private:
+  struct Header;
+
+  bool map(int fd, size_t capacity);
+
+  void close();
+
+  /**
+   * 取出tail处的数据包 无效或读写位置相差超过容量时丢弃全部已写入的数据
+   * @return 数据包总长度 没有数据时返回0
+   */
+  size_t nextPacket(uint64_t tail, uint64_t head, const uint8_t** payload, size_t* payloadSize);
+
+  bool waitData(uint64_t tail, int timeoutMs);
+
+  bool waitSpace(uint64_t head, size_t need, int timeoutMs);
+
+  void commitTail(uint64_t tail);
+
+ private:
+  PacketProcessor processor_;
+  uint8_t* base_ = nullptr;  // 映射的起始位置 包括Header页和两次映射的数据区
+  size_t mapSize_ = 0;
+  Header* header_ = nullptr;
+  uint8_t* data_ = nullptr;
+  size_t capacity_ = 0;
+  size_t peekSize_ = 0;  // peek获取的数据包总长度
+  Stats stats_;
+};
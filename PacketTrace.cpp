@@ -0,0 +1,152 @@
+#include "PacketTrace.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+PacketHistogram::PacketHistogram() {
+  reset();
+}
+
+/**
+ * @return 最高位1的位置 value不为0
+ */
+static inline unsigned int log2Floor(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return 63 - __builtin_clzll(value);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return (unsigned int)index;
+#else
+  unsigned int log2 = 0;
+  while (value >>= 1) log2++;
+  return log2;
+#endif
+}
+
+unsigned int PacketHistogram::bucketOf(uint64_t value) {
+  if (value < SUB_BUCKETS) return (unsigned int)value;
+  unsigned int log2 = log2Floor(value);
+  unsigned int shift = log2 - SUB_BITS;
+  return SUB_BUCKETS + shift * SUB_BUCKETS + (unsigned int)((value >> shift) - SUB_BUCKETS);
+}
+
+uint64_t PacketHistogram::bucketUpper(unsigned int bucket) {
+  if (bucket < SUB_BUCKETS) return bucket;
+  unsigned int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+  uint64_t mantissa = SUB_BUCKETS + (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+void PacketHistogram::record(uint64_t value) {
+  buckets_[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max && not max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t PacketHistogram::count() const {
+  return count_.load(std::memory_order_relaxed);
+}
+
+uint64_t PacketHistogram::max() const {
+  return max_.load(std::memory_order_relaxed);
+}
+
+double PacketHistogram::mean() const {
+  const uint64_t count = this->count();
+  return count ? (double)sum_.load(std::memory_order_relaxed) / count : 0;
+}
+
+uint64_t PacketHistogram::percentile(double p) const {
+  uint64_t total = 0;
+  for (const auto& b : buckets_) {
+    total += b.load(std::memory_order_relaxed);
+  }
+  if (total == 0) return 0;
+
+  uint64_t target = (uint64_t)(p / 100 * total + 0.5);
+  if (target == 0) target = 1;
+  if (target > total) target = total;
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < BUCKETS; i++) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= target) return std::min(bucketUpper(i), max());
+  }
+  return max();
+}
+
+void PacketHistogram::reset() {
+  for (auto& b : buckets_) {
+    b.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+PacketTrace& PacketTrace::global() {
+  static PacketTrace trace;
+  return trace;
+}
+
+const char* PacketTrace::stageName(Stage stage) {
+  switch (stage) {
+    case LENGTH:
+      return "length";
+    case REASSEMBLY:
+      return "reassembly";
+    case CRC:
+      return "crc";
+    case HANDLER:
+      return "handler";
+    case TOTAL:
+      return "total";
+    default:
+      return "unknown";
+  }
+}
+
+PacketHistogram& PacketTrace::histogram(Stage stage) {
+  return histograms_[stage];
+}
+
+const PacketHistogram& PacketTrace::histogram(Stage stage) const {
+  return histograms_[stage];
+}
+
+void PacketTrace::record(uint64_t header, uint64_t length, uint64_t complete, uint64_t crc, uint64_t handled) {
+  histograms_[LENGTH].record(length - header);
+  histograms_[REASSEMBLY].record(complete - length);
+  histograms_[CRC].record(crc - complete);
+  histograms_[HANDLER].record(handled - crc);
+  histograms_[TOTAL].record(handled - header);
+}
+
+std::string PacketTrace::dump() const {
+  std::string out;
+  char line[256];
+  snprintf(line, sizeof(line), "%-10s %10s %10s %10s %10s %10s %10s %10s\n", "stage(us)", "count", "mean", "p50", "p90", "p99", "p99.9",
+           "max");
+  out += line;
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    const auto& h = histograms_[i];
+    snprintf(line, sizeof(line), "%-10s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", stageName((Stage)i),
+             (unsigned long long)h.count(), h.mean() / 1000, h.percentile(50) / 1000.0, h.percentile(90) / 1000.0, h.percentile(99) / 1000.0,
+             h.percentile(99.9) / 1000.0, h.max() / 1000.0);
+    out += line;
+  }
+  return out;
+}
+
+void PacketTrace::reset() {
+  for (auto& h : histograms_) {
+    h.reset();
+  }
+}
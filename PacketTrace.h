@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * 无锁的对数-线性直方图(HDR风格) 记录非负整数 多线程可同时记录
+ * 每个2的幂区间再均分为SUB_BUCKETS段 相对误差不超过1/SUB_BUCKETS
+ */
+class PacketHistogram {
+ public:
+  static const unsigned int SUB_BITS = 4;
+  static const unsigned int SUB_BUCKETS = 1u << SUB_BITS;
+  static const unsigned int BUCKETS = SUB_BUCKETS + (64 - SUB_BITS) * SUB_BUCKETS;
+
+ public:
+  PacketHistogram();
+
+  PacketHistogram(const PacketHistogram&) = delete;
+  PacketHistogram& operator=(const PacketHistogram&) = delete;
+
+ public:
+  void record(uint64_t value);
+
+  uint64_t count() const;
+
+  uint64_t max() const;
+
+  double mean() const;
+
+  /**
+   * @param p 百分位 0~100
+   * @return 落在该百分位的区间上界 没有记录时返回0
+   */
+  uint64_t percentile(double p) const;
+
+  /**
+   * 与record并发调用时 部分记录可能保留或丢失
+   */
+  void reset();
+
+  static unsigned int bucketOf(uint64_t value);
+
+  /**
+   * @return 区间内的最大值
+   */
+  static uint64_t bucketUpper(unsigned int bucket);
+
+ private:
+  std::atomic<uint64_t> buckets_[BUCKETS];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+/**
+ * 数据包各阶段耗时(纳秒)
+ * 编译时定义PacketProcessor_ENABLE_TRACE(CMake选项PacketProcessor_WITH_TRACE)后 PacketProcessor在以下时刻打点并记录到global():
+ * 找到包头 -> 长度校验通过 -> 数据全部到达 -> 数据校验完成 -> OnPacketHandle返回
+ * 未定义时打点代码不参与编译
+ */
+class PacketTrace {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum Stage {
+    LENGTH,      // 找到包头到长度校验通过: 等待长度字节
+    REASSEMBLY,  // 长度校验通过到数据全部到达: 等待数据
+    CRC,         // 数据校验
+    HANDLER,     // 解压及OnPacketHandle
+    TOTAL,       // 找到包头到OnPacketHandle返回
+    STAGE_COUNT,
+  };
+
+ public:
+  static PacketTrace& global();
+
+  static const char* stageName(Stage stage);
+
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+  }
+
+ public:
+  PacketHistogram& histogram(Stage stage);
+
+  const PacketHistogram& histogram(Stage stage) const;
+
+  /**
+   * 记录一个数据包的各时刻
+   */
+  void record(uint64_t header, uint64_t length, uint64_t complete, uint64_t crc, uint64_t handled);
+
+  /**
+   * @return 各阶段的计数、平均值和百分位(微秒) 每阶段一行
+   */
+  std::string dump() const;
+
+  void reset();
+
+ private:
+  PacketHistogram histograms_[STAGE_COUNT];
+};
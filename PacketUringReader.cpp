@@ -0,0 +1,223 @@
+#include "PacketUringReader.h"
+
+#include <liburing.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// #define PacketProcessor_LOG_SHOW_VERBOSE
+#include "log.h"
+
+static const unsigned short BUFFER_GROUP = 0;
+
+struct PacketUringReader::Connection {
+  Connection(int fd, PacketProcessor* processor, bool socket) : fd(fd), processor(processor), socket(socket) {}
+
+  int fd;
+  PacketProcessor* processor;
+  bool socket;          // socket使用multishot recv
+  bool armed = false;   // 有未结束的读取请求
+  bool closed = false;  // 已读到结尾或出错
+  bool removed = false;
+};
+
+PacketUringReader::PacketUringReader(unsigned bufferCount, size_t bufferSize, unsigned entries)
+    : ring_(new io_uring), bufferCount_(bufferCount), bufferSize_(bufferSize) {
+  assert(bufferCount > 0 && bufferCount <= 32768 && (bufferCount & (bufferCount - 1)) == 0);
+  assert(bufferSize > 0 && bufferSize <= UINT32_MAX);
+
+  int ret = io_uring_queue_init(entries, ring_.get(), 0);
+  if (ret < 0) {
+    PacketProcessor_LOGE("io_uring_queue_init failed: %s", strerror(-ret));
+    return;
+  }
+  bufRing_ = io_uring_setup_buf_ring(ring_.get(), bufferCount_, BUFFER_GROUP, 0, &ret);
+  if (bufRing_ == nullptr) {
+    PacketProcessor_LOGE("io_uring_setup_buf_ring failed: %s", strerror(-ret));
+    io_uring_queue_exit(ring_.get());
+    return;
+  }
+
+  buffers_.reset(new uint8_t[bufferCount_ * bufferSize_]);
+  const int mask = io_uring_buf_ring_mask(bufferCount_);
+  for (unsigned i = 0; i < bufferCount_; i++) {
+    io_uring_buf_ring_add(bufRing_, buffers_.get() + i * bufferSize_, bufferSize_, i, mask, i);
+  }
+  io_uring_buf_ring_advance(bufRing_, bufferCount_);
+  valid_ = true;
+}
+
+PacketUringReader::~PacketUringReader() {
+  if (not valid_) return;
+  io_uring_free_buf_ring(ring_.get(), bufRing_, bufferCount_, BUFFER_GROUP);
+  io_uring_queue_exit(ring_.get());
+}
+
+bool PacketUringReader::valid() const {
+  return valid_;
+}
+
+void PacketUringReader::setOnCloseHandle(const OnCloseHandle& handle) {
+  onCloseHandle_ = handle;
+}
+
+bool PacketUringReader::add(int fd, PacketProcessor* processor) {
+  if (not valid_ || connections_.count(fd)) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    PacketProcessor_LOGE("fstat failed: %d, %s", fd, strerror(errno));
+    return false;
+  }
+
+  std::unique_ptr<Connection> connection(new Connection(fd, processor, S_ISSOCK(st.st_mode)));
+  if (not submitRead(connection.get())) return false;
+  connections_[fd] = std::move(connection);
+  return true;
+}
+
+void PacketUringReader::remove(int fd) {
+  auto it = connections_.find(fd);
+  if (it == connections_.end()) return;
+
+  std::unique_ptr<Connection> connection = std::move(it->second);
+  connections_.erase(it);
+  connection->removed = true;
+  connection->processor = nullptr;
+  if (not connection->armed) return;
+
+  // 取消读取请求 其最后一个完成事件到达后再释放
+  io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+  if (sqe == nullptr) {
+    io_uring_submit(ring_.get());
+    sqe = io_uring_get_sqe(ring_.get());
+  }
+  if (sqe) {
+    io_uring_prep_cancel64(sqe, (uint64_t)(uintptr_t)connection.get(), 0);
+    io_uring_sqe_set_data(sqe, nullptr);
+  } else {
+    // 提交队列已满 同步取消 返回时读取请求已结束 其完成事件仍在队列中
+    io_uring_sync_cancel_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(uintptr_t)connection.get();
+    reg.timeout.tv_sec = -1;
+    reg.timeout.tv_nsec = -1;
+    int ret = io_uring_register_sync_cancel(ring_.get(), &reg);
+    if (ret < 0 && ret != -ENOENT && ret != -EALREADY) {
+      PacketProcessor_LOGE("sync cancel failed: %d, %s", connection->fd, strerror(-ret));
+    }
+  }
+  closing_.push_back(std::move(connection));
+}
+
+int PacketUringReader::poll(int timeoutMs) {
+  if (not valid_) return -EINVAL;
+
+  int ret = io_uring_submit(ring_.get());
+  if (ret < 0) return ret;
+
+  io_uring_cqe* cqe;
+  if (timeoutMs < 0) {
+    ret = io_uring_wait_cqe(ring_.get(), &cqe);
+  } else {
+    __kernel_timespec ts;
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+    ret = io_uring_wait_cqe_timeout(ring_.get(), &cqe, &ts);
+  }
+  if (ret == -ETIME || ret == -EINTR) return 0;
+  if (ret < 0) return ret;
+
+  // 回调中可能add/remove 先取出事件内容再处理
+  int count = 0;
+  while (io_uring_peek_cqe(ring_.get(), &cqe) == 0) {
+    auto connection = (Connection*)io_uring_cqe_get_data(cqe);
+    const int res = cqe->res;
+    const uint32_t flags = cqe->flags;
+    io_uring_cqe_seen(ring_.get(), cqe);
+    count++;
+    if (connection) handleCompletion(connection, res, flags);
+  }
+  stats_.completions += count;
+
+  // 尽早提交重新发起的读取请求
+  io_uring_submit(ring_.get());
+  return count;
+}
+
+void PacketUringReader::handleCompletion(Connection* connection, int res, uint32_t flags) {
+  const bool more = flags & IORING_CQE_F_MORE;
+
+  if (flags & IORING_CQE_F_BUFFER) {
+    const uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    if (res > 0 && connection->processor) {
+      stats_.bytes += res;
+      connection->processor->feed(buffers_.get() + bid * bufferSize_, res);
+    }
+    recycle(bid);
+  }
+
+  if (not more) connection->armed = false;
+
+  if (connection->removed) {
+    if (not connection->armed) {
+      auto it = std::find_if(closing_.begin(), closing_.end(), [&](const std::unique_ptr<Connection>& c) {
+        return c.get() == connection;
+      });
+      if (it != closing_.end()) closing_.erase(it);
+    }
+    return;
+  }
+
+  if (res == -ENOBUFS) {
+    stats_.noBuffers++;
+    PacketProcessor_LOGV("no buffers: %d", connection->fd);
+  } else if (res <= 0 && res != -ECANCELED) {
+    // 回调中可能remove 之后不再访问connection
+    connection->closed = true;
+    if (onCloseHandle_) onCloseHandle_(connection->fd, -res);
+    return;
+  }
+
+  if (not connection->armed && not connection->closed) submitRead(connection);
+}
+
+bool PacketUringReader::submitRead(Connection* connection) {
+  io_uring_sqe* sqe = io_uring_get_sqe(ring_.get());
+  if (sqe == nullptr) {
+    io_uring_submit(ring_.get());
+    sqe = io_uring_get_sqe(ring_.get());
+    if (sqe == nullptr) {
+      PacketProcessor_LOGE("submission queue full: %d", connection->fd);
+      return false;
+    }
+  }
+
+  if (connection->socket) {
+    io_uring_prep_recv_multishot(sqe, connection->fd, nullptr, 0, 0);
+  } else {
+    io_uring_prep_read(sqe, connection->fd, nullptr, bufferSize_, (uint64_t)-1);
+  }
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  io_uring_sqe_set_data(sqe, connection);
+  connection->armed = true;
+  stats_.submits++;
+  return true;
+}
+
+void PacketUringReader::recycle(uint16_t bid) {
+  io_uring_buf_ring_add(bufRing_, buffers_.get() + bid * bufferSize_, bufferSize_, bid, io_uring_buf_ring_mask(bufferCount_), 0);
+  io_uring_buf_ring_advance(bufRing_, 1);
+}
+
+size_t PacketUringReader::size() const {
+  return connections_.size();
+}
+
+const PacketUringReader::Stats& PacketUringReader::stats() const {
+  return stats_;
+}
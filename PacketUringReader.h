@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "PacketProcessor.h"
+
+struct io_uring;
+struct io_uring_buf_ring;
+
+/**
+ * 基于io_uring读取多个fd 数据直接从内核填充的缓存送入各fd的PacketProcessor 无需每次read系统调用
+ * 使用注册的缓存环(provided buffer ring): socket使用multishot recv 一次提交持续接收; 管道等其他fd使用带缓存选择的read 每次完成后重新提交
+ * 需要liburing(2.4以上)及Linux 6.0以上内核 仅在找到liburing时编译(PacketProcessor_WITH_URING)
+ * 非线程安全 add/remove/poll需在同一线程调用 OnPacketHandle在poll中回调
+ */
+class PacketUringReader {
+ public:
+  /**
+   * fd读到结尾或出错时回调 之后不再读取此fd 仍需调用remove
+   * error为0表示对端关闭 否则为errno
+   */
+  using OnCloseHandle = std::function<void(int fd, int error)>;
+
+  struct Stats {
+    uint64_t completions = 0;  // 完成事件数
+    uint64_t bytes = 0;        // 读取的字节数
+    uint64_t submits = 0;      // 提交的读取请求数 multishot只在重新提交时计数
+    uint64_t noBuffers = 0;    // 缓存环耗尽次数
+  };
+
+ public:
+  /**
+   * @param bufferCount 缓存环中的缓存数 需为2的幂
+   * @param bufferSize 单个缓存字节数
+   * @param entries 提交队列长度
+   */
+  explicit PacketUringReader(unsigned bufferCount = 256, size_t bufferSize = 16 * 1024, unsigned entries = 256);
+
+  ~PacketUringReader();
+
+  PacketUringReader(const PacketUringReader&) = delete;
+  PacketUringReader& operator=(const PacketUringReader&) = delete;
+
+ public:
+  /**
+   * @return io_uring是否初始化成功(内核不支持时失败)
+   */
+  bool valid() const;
+
+  void setOnCloseHandle(const OnCloseHandle& handle);
+
+  /**
+   * 开始读取fd 不持有fd和processor 需在remove之后再关闭/释放
+   * @param fd
+   * @param processor
+   * @return fd已添加或未初始化时返回false
+   */
+  bool add(int fd, PacketProcessor* processor);
+
+  /**
+   * 停止读取fd 之后不再送入其processor
+   * @param fd
+   */
+  void remove(int fd);
+
+  /**
+   * 提交读取请求并处理所有已完成的事件
+   * @param timeoutMs 没有事件时最长等待时间 为负时一直等待
+   * @return 处理的完成事件数 出错时返回负的errno
+   */
+  int poll(int timeoutMs = -1);
+
+  size_t size() const;
+
+  const Stats& stats() const;
+
+ private:
+  struct Connection;
+
+  bool submitRead(Connection* connection);
+
+  void recycle(uint16_t bid);
+
+  void handleCompletion(Connection* connection, int res, uint32_t flags);
+
+ private:
+  std::unique_ptr<io_uring> ring_;
+  io_uring_buf_ring* bufRing_ = nullptr;
+  std::unique_ptr<uint8_t[]> buffers_;
+  unsigned bufferCount_;
+  size_t bufferSize_;
+  bool valid_ = false;
+
+  std::unordered_map<int, std::unique_ptr<Connection>> connections_;
+  std::vector<std::unique_ptr<Connection>> closing_;  // 已remove 等待读取请求结束
+  OnCloseHandle onCloseHandle_;
+  Stats stats_;
+};
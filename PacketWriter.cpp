@@ -0,0 +1,117 @@
+#include "PacketWriter.h"
+
+#include <utility>
+
+// #define PacketProcessor_LOG_SHOW_VERBOSE
+#include "log.h"
+
+static uint64_t toUs(PacketWriter::Clock::duration d) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+double PacketWriter::Stats::avgBatchFrames() const {
+  return batches ? (double)frames / batches : 0;
+}
+
+double PacketWriter::Stats::avgBatchBytes() const {
+  return batches ? (double)bytes / batches : 0;
+}
+
+double PacketWriter::Stats::avgDelayUs() const {
+  return frames ? (double)totalDelayUs / frames : 0;
+}
+
+PacketWriter::PacketWriter(const PacketProcessor& processor, OnFlushHandle handle)
+    : processor_(processor), onFlushHandle_(std::move(handle)) {
+  buffer_.reserve(flushSize_);
+}
+
+void PacketWriter::setOnFlushHandle(const OnFlushHandle& handle) {
+  onFlushHandle_ = handle;
+}
+
+void PacketWriter::setFlushSize(size_t size) {
+  flushSize_ = size;
+  buffer_.reserve(flushSize_);
+}
+
+void PacketWriter::setFlushDelay(Clock::duration delay) {
+  flushDelay_ = delay;
+}
+
+void PacketWriter::write(const void* data, uint32_t size) {
+  const auto now = Clock::now();
+  if (pendingFrames_ == 0) {
+    firstTime_ = now;
+  } else {
+    pendingOffsetSumUs_ += toUs(now - firstTime_);
+  }
+
+  processor_.packForeach(data, size, [this](uint8_t* data, size_t size) {
+    buffer_.insert(buffer_.end(), data, data + size);
+  });
+  pendingFrames_++;
+
+  if (buffer_.size() >= flushSize_ || now - firstTime_ >= flushDelay_) {
+    flush(now);
+  }
+}
+
+void PacketWriter::write(const std::string& data) {
+  write(data.data(), data.length());
+}
+
+void PacketWriter::poll(Clock::time_point now) {
+  if (pendingFrames_ == 0) return;
+  if (now - firstTime_ >= flushDelay_) {
+    flush(now);
+  }
+}
+
+void PacketWriter::flush() {
+  flush(Clock::now());
+}
+
+PacketWriter::Clock::time_point PacketWriter::deadline() const {
+  if (pendingFrames_ == 0) return Clock::time_point::max();
+  return firstTime_ + flushDelay_;
+}
+
+size_t PacketWriter::pendingSize() const {
+  return buffer_.size();
+}
+
+const PacketWriter::Stats& PacketWriter::stats() const {
+  return stats_;
+}
+
+void PacketWriter::resetStats() {
+  stats_ = Stats();
+}
+
+void PacketWriter::flush(Clock::time_point now) {
+  if (pendingFrames_ == 0) return;
+  PacketProcessor_LOGV("flush: frames=%u, bytes=%zu", pendingFrames_, buffer_.size());
+
+  // 排队时间: 每个包为now减去其加入时间
+  const uint64_t maxDelayUs = toUs(now - firstTime_);
+  stats_.batches++;
+  stats_.frames += pendingFrames_;
+  stats_.bytes += buffer_.size();
+  stats_.totalDelayUs += maxDelayUs * pendingFrames_ - pendingOffsetSumUs_;
+  if (maxDelayUs > stats_.maxDelayUs) stats_.maxDelayUs = maxDelayUs;
+
+  // 先重置状态 允许在回调中继续write
+  std::vector<uint8_t> out;
+  out.swap(buffer_);
+  pendingFrames_ = 0;
+  pendingOffsetSumUs_ = 0;
+
+  if (onFlushHandle_) {
+    onFlushHandle_(out.data(), out.size());
+  }
+
+  // 归还缓存以便复用
+  out.clear();
+  if (buffer_.empty()) buffer_.swap(out);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "PacketProcessor.h"
+
+/**
+ * 合并写入: 将多个数据包打包到同一个缓存 满足以下任一条件时一次性输出
+ * 1. 缓存字节数达到flushSize
+ * 2. 最早的数据包等待时间达到flushDelay(需调用write或poll触发检查)
+ * 3. 主动调用flush
+ */
+class PacketWriter {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using OnFlushHandle = std::function<void(const uint8_t* data, size_t size)>;
+
+  struct Stats {
+    uint64_t batches = 0;       // 输出次数
+    uint64_t frames = 0;        // 数据包数
+    uint64_t bytes = 0;         // 输出字节数
+    uint64_t totalDelayUs = 0;  // 所有数据包排队时间之和
+    uint64_t maxDelayUs = 0;    // 最大排队时间
+
+    double avgBatchFrames() const;
+    double avgBatchBytes() const;
+    double avgDelayUs() const;
+  };
+
+ public:
+  explicit PacketWriter(const PacketProcessor& processor, OnFlushHandle handle = nullptr);
+
+ public:
+  void setOnFlushHandle(const OnFlushHandle& handle);
+
+  /**
+   * 缓存达到此字节数时输出 默认4KBytes
+   * @param size
+   */
+  void setFlushSize(size_t size);
+
+  /**
+   * 数据包最长排队时间 默认1ms
+   * @param delay
+   */
+  void setFlushDelay(Clock::duration delay);
+
+  /**
+   * 打包数据并加入缓存
+   * @param data 视为uint8_t*
+   * @param size
+   */
+  void write(const void* data, uint32_t size);
+
+  void write(const std::string& data);
+
+  /**
+   * 检查排队时间 超时则输出 用于在没有新数据时由事件循环定时调用
+   * @param now
+   */
+  void poll(Clock::time_point now = Clock::now());
+
+  /**
+   * 立即输出缓存
+   */
+  void flush();
+
+  /**
+   * @return 下一次需要输出的时间点 没有缓存数据时返回Clock::time_point::max()
+   */
+  Clock::time_point deadline() const;
+
+  size_t pendingSize() const;
+
+  const Stats& stats() const;
+
+  void resetStats();
+
+ private:
+  void flush(Clock::time_point now);
+
+ private:
+  const PacketProcessor& processor_;
+  OnFlushHandle onFlushHandle_;
+
+  size_t flushSize_ = 4096;
+  Clock::duration flushDelay_ = std::chrono::milliseconds(1);
+
+  std::vector<uint8_t> buffer_;      // 待输出数据 复用以避免每次分配
+  uint32_t pendingFrames_ = 0;       // 缓存中的数据包数
+  Clock::time_point firstTime_;      // 缓存中最早的数据包加入时间
+  uint64_t pendingOffsetSumUs_ = 0;  // 缓存中数据包相对firstTime_的加入时间之和
+
+  Stats stats_;
+};
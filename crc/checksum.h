@@ -79,6 +79,7 @@
 unsigned char *checksum_NMEA(const unsigned char *input_str, unsigned char *result);
 uint8_t crc_8(const unsigned char *input_str, size_t num_bytes);
 uint16_t crc_16(const unsigned char *input_str, size_t num_bytes);
+uint16_t crc_16_combine(uint16_t crc1, uint16_t crc2, size_t len2);
 uint32_t crc_32(const unsigned char *input_str, size_t num_bytes);
 uint64_t crc_64_ecma(const unsigned char *input_str, size_t num_bytes);
 uint64_t crc_64_we(const unsigned char *input_str, size_t num_bytes);
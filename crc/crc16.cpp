@@ -69,6 +69,73 @@ uint16_t crc_16(const unsigned char *input_str, size_t num_bytes) {
 
 } /* crc_16 */
 
+/*
+ * uint16_t crc_16_combine( uint16_t crc1, uint16_t crc2, size_t len2 );
+ *
+ * The function crc_16_combine() returns the CRC16 of two adjacent byte strings
+ * A and B from crc1 = crc_16(A) and crc2 = crc_16(B), where len2 is the number
+ * of bytes in B. Because CRC16 starts at zero and has no final xor, the CRC of
+ * A followed by B equals crc1 advanced over len2 zero bytes, xored with crc2.
+ * Advancing over the zero bytes is a 16x16 matrix over GF(2) raised to the
+ * power len2 by repeated squaring, so the cost is O(log(len2)).
+ */
+
+static uint16_t gf2_matrix_times(const uint16_t *mat, uint16_t vec) {
+  uint16_t sum = 0;
+
+  while (vec) {
+    if (vec & 1) sum ^= *mat;
+    vec >>= 1;
+    mat++;
+  }
+
+  return sum;
+
+} /* gf2_matrix_times */
+
+static void gf2_matrix_square(uint16_t *square, const uint16_t *mat) {
+  int n;
+
+  for (n = 0; n < 16; n++) square[n] = gf2_matrix_times(mat, mat[n]);
+
+} /* gf2_matrix_square */
+
+uint16_t crc_16_combine(uint16_t crc1, uint16_t crc2, size_t len2) {
+  int n;
+  uint16_t row;
+  uint16_t even[16];  // even-power-of-two zeros operator
+  uint16_t odd[16];   // odd-power-of-two zeros operator
+
+  if (len2 == 0) return crc1;
+
+  // operator for one zero bit in odd
+  odd[0] = CRC_POLY_16;
+  row = 1;
+  for (n = 1; n < 16; n++) {
+    odd[n] = row;
+    row <<= 1;
+  }
+
+  // operator for two zero bits in even, four zero bits in odd
+  gf2_matrix_square(even, odd);
+  gf2_matrix_square(odd, even);
+
+  // apply len2 zeros to crc1 (first square puts the operator for one zero byte, eight zero bits, in even)
+  do {
+    gf2_matrix_square(even, odd);
+    if (len2 & 1) crc1 = gf2_matrix_times(even, crc1);
+    len2 >>= 1;
+    if (len2 == 0) break;
+
+    gf2_matrix_square(odd, even);
+    if (len2 & 1) crc1 = gf2_matrix_times(odd, crc1);
+    len2 >>= 1;
+  } while (len2 != 0);
+
+  return crc1 ^ crc2;
+
+} /* crc_16_combine */
+
 /*
  * uint16_t crc_modbus( const unsigned char *input_str, size_t num_bytes );
  *
@@ -144,3 +211,11 @@ static void init_crc16_tab(void) {
   crc_tab16_init = true;
 
 } /* init_crc16_tab */
+
+/*
+ * The table is also built during static initialization, so that it is ready
+ * before any thread is started and the lazy initialization above can never
+ * race between threads.
+ */
+
+static const bool crc_tab16_static_init = (init_crc16_tab(), true);
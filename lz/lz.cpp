@@ -0,0 +1,147 @@
+#include "lz.h"
+
+#include <string.h>
+
+static const unsigned int MIN_MATCH = 4;
+static const unsigned int MAX_OFFSET = 65535;
+static const unsigned int HASH_LOG = 12;
+static const unsigned int RUN_MASK = 15;
+
+static inline uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+  return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+/**
+ * 写入长度扩展字节
+ * @return 写入后的位置 空间不足时返回NULL
+ */
+static uint8_t *writeLength(uint8_t *op, const uint8_t *oend, size_t len) {
+  while (len >= 255) {
+    if (op >= oend) return NULL;
+    *op++ = 255;
+    len -= 255;
+  }
+  if (op >= oend) return NULL;
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+/**
+ * 输出一个序列 matchLen为0时表示最后一个只有字面量的序列
+ */
+static uint8_t *writeSequence(uint8_t *op, const uint8_t *oend, const uint8_t *literal, size_t litLen, size_t offset, size_t matchLen) {
+  if (op >= oend) return NULL;
+  uint8_t *token = op++;
+  size_t ml = matchLen ? matchLen - MIN_MATCH : 0;
+  *token = (uint8_t)(((litLen < RUN_MASK ? litLen : RUN_MASK) << 4) | (ml < RUN_MASK ? ml : RUN_MASK));
+
+  if (litLen >= RUN_MASK) {
+    op = writeLength(op, oend, litLen - RUN_MASK);
+    if (op == NULL) return NULL;
+  }
+  if ((size_t)(oend - op) < litLen) return NULL;
+  memcpy(op, literal, litLen);
+  op += litLen;
+
+  if (matchLen == 0) return op;
+
+  if (oend - op < 2) return NULL;
+  *op++ = (uint8_t)(offset & 0xff);
+  *op++ = (uint8_t)(offset >> 8);
+  if (ml >= RUN_MASK) {
+    op = writeLength(op, oend, ml - RUN_MASK);
+  }
+  return op;
+}
+
+size_t lz_compress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstCap) {
+  // 16KB 不放在栈上 每个线程一份 可多线程同时压缩
+  static thread_local uint32_t table[1u << HASH_LOG];
+  memset(table, 0, sizeof(table));
+
+  uint8_t *op = dst;
+  const uint8_t *oend = dst + dstCap;
+  size_t anchor = 0;
+  size_t ip = 0;
+
+  while (ip + MIN_MATCH <= srcSize) {
+    uint32_t seq = read32(src + ip);
+    uint32_t h = hash32(seq);
+    size_t ref = table[h];
+    table[h] = (uint32_t)ip;
+
+    if (ref < ip && ip - ref <= MAX_OFFSET && read32(src + ref) == seq) {
+      size_t len = MIN_MATCH;
+      while (ip + len < srcSize && src[ref + len] == src[ip + len]) len++;
+
+      op = writeSequence(op, oend, src + anchor, ip - anchor, ip - ref, len);
+      if (op == NULL) return 0;
+
+      ip += len;
+      anchor = ip;
+    } else {
+      ip++;
+    }
+  }
+
+  op = writeSequence(op, oend, src + anchor, srcSize - anchor, 0, 0);
+  if (op == NULL) return 0;
+  return op - dst;
+}
+
+/**
+ * 读取长度扩展字节
+ * @return 成功返回true
+ */
+static bool readLength(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+  uint8_t b;
+  do {
+    if (*ip >= iend) return false;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+size_t lz_decompress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstCap) {
+  const uint8_t *ip = src;
+  const uint8_t *iend = src + srcSize;
+  uint8_t *op = dst;
+  const uint8_t *oend = dst + dstCap;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    size_t litLen = token >> 4;
+    if (litLen == RUN_MASK && !readLength(&ip, iend, &litLen)) return 0;
+    if ((size_t)(iend - ip) < litLen || (size_t)(oend - op) < litLen) return 0;
+    memcpy(op, ip, litLen);
+    ip += litLen;
+    op += litLen;
+
+    // 最后一个序列
+    if (ip == iend) break;
+
+    if (iend - ip < 2) return 0;
+    size_t offset = ip[0] | (size_t)ip[1] << 8;
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst)) return 0;
+
+    size_t matchLen = token & RUN_MASK;
+    if (matchLen == RUN_MASK && !readLength(&ip, iend, &matchLen)) return 0;
+    matchLen += MIN_MATCH;
+    if ((size_t)(oend - op) < matchLen) return 0;
+
+    // 可能重叠 逐字节复制
+    const uint8_t *match = op - offset;
+    while (matchLen--) *op++ = *match++;
+  }
+
+  return op - dst;
+}
@@ -0,0 +1,34 @@
+/*
+ * 轻量级LZ77压缩(LZ4块格式的简化版) 无外部依赖
+ *
+ * 格式: 由若干序列组成 每个序列为
+ *   token(1字节: 高4位字面量长度 低4位匹配长度-4)
+ *   + [字面量长度扩展字节...] + 字面量
+ *   + 偏移2字节(小端序) + [匹配长度扩展字节...]
+ * 最后一个序列只包含字面量 长度字段为15时后续字节累加 直到遇到非255的字节
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * 压缩 哈希表(16KB)为线程局部变量 不占用栈 可多线程同时调用
+ * @param src
+ * @param srcSize
+ * @param dst
+ * @param dstCap 输出缓存大小
+ * @return 压缩后的字节数 输出超过dstCap时返回0
+ */
+size_t lz_compress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstCap);
+
+/**
+ * 解压 会对输入做完整的边界检查 可用于不可信数据
+ * @param src
+ * @param srcSize
+ * @param dst
+ * @param dstCap 输出缓存大小
+ * @return 解压后的字节数 数据错误或输出超过dstCap时返回0
+ */
+size_t lz_decompress(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t dstCap);
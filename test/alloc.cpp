@@ -0,0 +1,321 @@
+/**
+ * 内存分配统计: 通过替换全局operator new统计每个数据包的分配次数 并记录缓存容量的峰值和稳定值
+ * 超出预算时失败 同时输出每包耗时作为基准
+ * 库源码以L_O_G_DISABLE_DATE_TIME编译进本程序 日志时间格式化的分配不计入
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+
+#include "PacketBuffer.h"
+#include "PacketProcessor.h"
+#include "PacketWriter.h"
+#include "assert_def.h"
+#include "log.h"
+
+/// 预算: 稳定状态下每包允许的分配次数
+#ifndef ALLOC_BUDGET_DECODE
+#define ALLOC_BUDGET_DECODE 0.0
+#endif
+#ifndef ALLOC_BUDGET_PACK
+#define ALLOC_BUDGET_PACK 1.0
+#endif
+#ifndef ALLOC_BUDGET_PACK_NO_COPY
+#define ALLOC_BUDGET_PACK_NO_COPY 0.0
+#endif
+/// 预算: 缓存峰值容量不超过(最大数据包总长度+单次feed字节数)的倍数
+#ifndef ALLOC_BUDGET_CAPACITY_RATIO
+#define ALLOC_BUDGET_CAPACITY_RATIO 2.0
+#endif
+
+static std::atomic<uint64_t> allocCount{0};
+static std::atomic<uint64_t> allocBytes{0};
+
+static void* countedAlloc(size_t size) {
+  allocCount++;
+  allocBytes += size;
+  return malloc(size ? size : 1);
+}
+
+void* operator new(size_t size) {
+  void* p = countedAlloc(size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  void* p = countedAlloc(size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return countedAlloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return countedAlloc(size);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+struct Traffic {
+  const char* name;
+  std::string stream;   // 一轮的数据
+  size_t frames;        // 一轮的有效数据包数
+  size_t maxFrameSize;  // 最大数据包总长度
+  size_t chunkMin;      // 每次feed的字节数范围
+  size_t chunkMax;
+};
+
+static Traffic smallBursts() {
+  PacketProcessor packer;
+  Traffic t{"small bursts", "", 0, 0, 256, 4096};
+  for (int i = 0; i < 2000; i++) {
+    auto frame = packer.pack(std::string(16, (char)i));
+    t.stream += frame;
+    t.frames++;
+    t.maxFrameSize = std::max(t.maxFrameSize, frame.size());
+  }
+  return t;
+}
+
+static Traffic largeFrames() {
+  PacketProcessor packer;
+  Traffic t{"large frames", "", 0, 0, 1500, 1500};
+  for (int i = 0; i < 20; i++) {
+    auto frame = packer.pack(std::string(64 * 1024 + i, (char)i));
+    t.stream += frame;
+    t.frames++;
+    t.maxFrameSize = std::max(t.maxFrameSize, frame.size());
+  }
+  return t;
+}
+
+static Traffic corruption() {
+  PacketProcessor packer;
+  std::default_random_engine generator(1);
+  Traffic t{"corruption", "", 0, 0, 1, 64};
+  for (int i = 0; i < 2000; i++) {
+    auto frame = packer.pack(std::string(1 + i % 200, (char)i));
+    t.maxFrameSize = std::max(t.maxFrameSize, frame.size());
+    switch (generator() % 4) {
+      case 0:
+        frame[generator() % frame.size()] ^= 0x10;
+        break;
+      case 1:
+        t.stream += "\x5A\xA5\x5A";
+        break;
+      default:
+        break;
+    }
+    t.stream += frame;
+  }
+  // 损坏的数据可能影响相邻数据包 不检查解出的数量
+  return t;
+}
+
+static Traffic compressed() {
+  PacketProcessor packer;
+  packer.setUseCompress(true);
+  Traffic t{"compressed", "", 0, 0, 64, 1024};
+  for (int i = 0; i < 500; i++) {
+    std::string data;
+    for (int j = 0; j < 100; j++) data += "value=" + std::to_string(j % 7) + ";";
+    auto frame = packer.pack(data);
+    t.stream += frame;
+    t.frames++;
+    t.maxFrameSize = std::max(t.maxFrameSize, data.size() + 10);
+  }
+  return t;
+}
+
+static void feedRound(PacketProcessor& processor, const Traffic& t, std::default_random_engine& generator, size_t* peak) {
+  std::uniform_int_distribution<size_t> dis(t.chunkMin, t.chunkMax);
+  for (size_t sent = 0; sent < t.stream.size();) {
+    size_t n = std::min(dis(generator), t.stream.size() - sent);
+    processor.feed(t.stream.data() + sent, n);
+    sent += n;
+    *peak = std::max(*peak, processor.bufferCapacity());
+  }
+}
+
+static void testDecode(const Traffic& t) {
+  const int ROUNDS = 10;
+  size_t frames = 0;
+  PacketProcessor processor([&](uint8_t*, size_t) {
+    frames++;
+  });
+  std::default_random_engine generator(2);
+
+  // 预热
+  size_t peak = 0;
+  feedRound(processor, t, generator, &peak);
+
+  frames = 0;
+  const uint64_t allocStart = allocCount;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ROUNDS; i++) {
+    feedRound(processor, t, generator, &peak);
+  }
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  const uint64_t allocs = allocCount - allocStart;
+  const size_t steady = processor.bufferCapacity();
+
+  const double perFrame = frames ? (double)allocs / frames : 0;
+  PacketProcessor_LOG("decode %-14s frames:%zu, allocs/frame:%.4f, peak capacity:%zu, steady capacity:%zu, %.1f ns/frame", t.name, frames,
+                      perFrame, peak, steady, frames ? (double)ns / frames : 0);
+  ASSERT(frames > 0);
+  if (t.frames) ASSERT(frames == t.frames * ROUNDS);
+  ASSERT(perFrame <= ALLOC_BUDGET_DECODE);
+  ASSERT(peak <= (t.maxFrameSize + t.chunkMax) * ALLOC_BUDGET_CAPACITY_RATIO);
+}
+
+static void testEncode() {
+  const int FRAMES = 10000;
+  const std::string data(100, 'x');
+  PacketProcessor processor;
+
+  // pack: 返回std::string 每包一次分配
+  uint64_t allocStart = allocCount;
+  size_t total = 0;
+  for (int i = 0; i < FRAMES; i++) {
+    total += processor.pack(data).size();
+  }
+  double perFrame = (double)(allocCount - allocStart) / FRAMES;
+  PacketProcessor_LOG("encode %-14s allocs/frame:%.4f", "pack", perFrame);
+  ASSERT(total == (data.size() + 10) * FRAMES);
+  ASSERT(perFrame <= ALLOC_BUDGET_PACK);
+
+  // packForeach
+  std::vector<uint8_t> out;
+  out.reserve(data.size() + 10);
+  allocStart = allocCount;
+  for (int i = 0; i < FRAMES; i++) {
+    out.clear();
+    processor.packForeach(data.data(), data.size(), [&](uint8_t* data, size_t size) {
+      out.insert(out.end(), data, data + size);
+    });
+  }
+  perFrame = (double)(allocCount - allocStart) / FRAMES;
+  PacketProcessor_LOG("encode %-14s allocs/frame:%.4f", "packForeach", perFrame);
+  ASSERT(perFrame <= ALLOC_BUDGET_PACK_NO_COPY);
+
+  // PacketBuffer
+  PacketBuffer buffer(processor, data.size());
+  allocStart = allocCount;
+  for (int i = 0; i < FRAMES; i++) {
+    memcpy(buffer.payload(), data.data(), data.size());
+    buffer.finalize(data.size());
+  }
+  perFrame = (double)(allocCount - allocStart) / FRAMES;
+  PacketProcessor_LOG("encode %-14s allocs/frame:%.4f", "PacketBuffer", perFrame);
+  ASSERT(perFrame <= ALLOC_BUDGET_PACK_NO_COPY);
+
+  // PacketWriter 预热后复用缓存
+  size_t flushed = 0;
+  PacketWriter writer(processor, [&](const uint8_t*, size_t size) {
+    flushed += size;
+  });
+  for (int i = 0; i < 100; i++) {
+    writer.write(data);
+  }
+  writer.flush();
+  allocStart = allocCount;
+  for (int i = 0; i < FRAMES; i++) {
+    writer.write(data);
+  }
+  writer.flush();
+  perFrame = (double)(allocCount - allocStart) / FRAMES;
+  PacketProcessor_LOG("encode %-14s allocs/frame:%.4f", "PacketWriter", perFrame);
+  ASSERT(flushed == (data.size() + 10) * (FRAMES + 100));
+  ASSERT(perFrame <= ALLOC_BUDGET_PACK_NO_COPY);
+
+#ifndef PacketProcessor_DISABLE_COMPRESS
+  // 压缩: 每个线程复用压缩缓存 预热后不分配
+  PacketProcessor compressor;
+  compressor.setUseCompress(true);
+  size_t compressed = 0;
+  PacketWriter compressWriter(compressor, [&](const uint8_t*, size_t size) {
+    compressed += size;
+  });
+  for (int i = 0; i < 1000; i++) {
+    compressWriter.write(data);
+  }
+  compressWriter.flush();
+  compressed = 0;
+  allocStart = allocCount;
+  for (int i = 0; i < FRAMES; i++) {
+    out.clear();
+    compressor.packForeach(data.data(), data.size(), [&](uint8_t* data, size_t size) {
+      out.insert(out.end(), data, data + size);
+    });
+    compressWriter.write(data);
+  }
+  compressWriter.flush();
+  perFrame = (double)(allocCount - allocStart) / FRAMES;
+  PacketProcessor_LOG("encode %-14s allocs/frame:%.4f", "compressed", perFrame);
+  ASSERT(out.size() < data.size() + 10);
+  ASSERT(compressed == out.size() * FRAMES);
+  ASSERT(perFrame <= ALLOC_BUDGET_PACK_NO_COPY);
+#endif
+}
+
+static void countFrame(void* ctx, uint8_t*, size_t) {
+  (*static_cast<size_t*>(ctx))++;
+}
+
+// 固定容量模式: 从构造开始不分配内存
+static void testStatic(const Traffic& t) {
+  static size_t frames;
+  static uint8_t out[4096];
+  std::default_random_engine generator(3);
+  const std::string data(100, 'x');
+
+  frames = 0;
+  // 每种流量使用新的processor 不受上一种流量残留状态影响 缓存较大 在统计开始前于堆上创建
+  std::unique_ptr<StaticPacketProcessor<80 * 1024, 80 * 1024>> processor(new StaticPacketProcessor<80 * 1024, 80 * 1024>(countFrame, &frames));
+  processor->setUseCompress(true);
+  const uint64_t allocStart = allocCount;
+  size_t peak = 0;
+  feedRound(*processor, t, generator, &peak);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT(processor->packTo(data.data(), data.size(), out, sizeof(out)) > 0);
+  }
+  const uint64_t allocs = allocCount - allocStart;
+  PacketProcessor_LOG("static %-14s frames:%zu, allocs:%llu", t.name, frames, (unsigned long long)allocs);
+  ASSERT(frames > 0);
+  if (t.frames) ASSERT(frames == t.frames);
+  ASSERT(allocs == 0);
+}
+
+int main() {
+  testDecode(smallBursts());
+  testDecode(largeFrames());
+  testDecode(corruption());
+  testDecode(compressed());
+  testEncode();
+  testStatic(smallBursts());
+  testStatic(largeFrames());
+  testStatic(corruption());
+  testStatic(compressed());
+  return 0;
+}
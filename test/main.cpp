@@ -1,8 +1,37 @@
+#include <cstring>
 #include <ctime>
+#include <memory>
 #include <random>
+#include <thread>
 
+#ifdef PacketProcessor_WITH_ENGINE
+#include "PacketEngine.h"
+#endif
+#ifdef PacketProcessor_WITH_PARALLEL_CRC
+#include "PacketCrcPool.h"
+#endif
+#ifdef PacketProcessor_WITH_SHM
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "PacketShmRing.h"
+#endif
+#ifdef PacketProcessor_WITH_URING
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "PacketUringReader.h"
+#endif
+#include "PacketBuffer.h"
+#include "PacketGovernor.h"
+#include "PacketIndex.h"
 #include "PacketProcessor.h"
+#include "PacketRouter.h"
+#include "PacketTrace.h"
+#include "PacketWriter.h"
 #include "assert_def.h"
+#include "crc/checksum.h"
 #include "log.h"
 
 static void simpleUsage() {
@@ -110,9 +139,1151 @@ static void testSerious() {
   ASSERT(pass);
 }
 
+#ifndef PacketProcessor_DISABLE_COMPRESS
+static void testCompress() {
+  PacketProcessor_LOG("******test compress******");
+  std::string TEST_PAYLOAD;
+  for (int i = 0; i < 1000; i++) {
+    TEST_PAYLOAD += "sensor:" + std::to_string(i % 10) + ";";
+  }
+  std::string RANDOM_PAYLOAD;
+  std::default_random_engine generator(time(nullptr));
+  for (int i = 0; i < 1000; i++) {
+    RANDOM_PAYLOAD.push_back((char)generator());
+  }
+
+  int count = 0;
+  std::string expect;
+  PacketProcessor processor([&](uint8_t* data, size_t size) {
+    PacketProcessor_LOG("get payload size:%zu", size);
+    ASSERT(std::string((char*)data, size) == expect);
+    count++;
+  });
+
+  PacketProcessor packer;
+  packer.setUseCompress(true);
+
+  // 可压缩数据
+  expect = TEST_PAYLOAD;
+  auto payload = packer.pack(TEST_PAYLOAD);
+  PacketProcessor_LOG("compressed: %zu -> %zu", TEST_PAYLOAD.size(), payload.size());
+  ASSERT(payload.size() < TEST_PAYLOAD.size());
+  processor.feed(payload.data(), payload.size());
+  ASSERT(count == 1);
+  for (size_t i = 0; i < payload.size(); i++) {
+    processor.feed(payload.data() + i, 1);
+  }
+  ASSERT(count == 2);
+
+  // 不可压缩数据 保持原样
+  expect = RANDOM_PAYLOAD;
+  payload = packer.pack(RANDOM_PAYLOAD);
+  ASSERT(payload == PacketProcessor().pack(RANDOM_PAYLOAD));
+  processor.feed(payload.data(), payload.size());
+  ASSERT(count == 3);
+
+  // 数据CRC
+  packer.setUseCrc(true);
+  processor.setUseCrc(true);
+  expect = TEST_PAYLOAD;
+  payload = packer.pack(TEST_PAYLOAD);
+  processor.feed(payload.data(), payload.size());
+  ASSERT(count == 4);
+
+  // packForeach与pack输出相同
+  std::string foreach;
+  packer.packForeach(TEST_PAYLOAD.data(), TEST_PAYLOAD.size(), [&](uint8_t* data, size_t size) {
+    foreach.append((char*)data, size);
+  });
+  ASSERT(foreach == payload);
+
+  // 同一个const对象多线程同时打包
+  const PacketProcessor& shared = packer;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 200; i++) {
+        ASSERT(shared.pack(TEST_PAYLOAD) == payload);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  // 长度最高位为压缩标志 数据过长时拒绝
+  uint8_t out[16];
+  size_t frameSize;
+  ASSERT(packer.pack(out, PacketProcessor::MAX_DATA_SIZE + 1u).empty());
+  ASSERT(packer.packTo(out, PacketProcessor::MAX_DATA_SIZE + 1u, out, SIZE_MAX) == 0);
+  ASSERT(packer.packInPlace(out, PacketProcessor::MAX_DATA_SIZE + 1u, &frameSize) == nullptr && frameSize == 0);
+  packer.packForeach(out, PacketProcessor::MAX_DATA_SIZE + 1u, [](uint8_t*, size_t) {
+    ASSERT(false);
+  });
+}
+#endif
+
+static void testParallelCrc() {
+  PacketProcessor_LOG("******test parallel crc******");
+  std::default_random_engine generator(time(nullptr));
+  std::string data;
+  for (int i = 0; i < 4 * 1024 * 1024 + 123; i++) {
+    data.push_back((char)generator());
+  }
+  const auto* p = (const uint8_t*)data.data();
+
+  // 相邻两段合并
+  for (int i = 0; i < 1000; i++) {
+    const size_t size = generator() % 5000;
+    const size_t split = generator() % (size + 1);
+    ASSERT(crc_16_combine(crc_16(p, split), crc_16(p + split, size - split), size - split) == crc_16(p, size));
+  }
+  ASSERT(crc_16_combine(crc_16(p, 100), crc_16(p + 100, data.size() - 100), data.size() - 100) == crc_16(p, data.size()));
+
+#ifdef PacketProcessor_WITH_PARALLEL_CRC
+  const uint16_t expect = crc_16(p, data.size());
+  for (size_t threads : {2, 3, 8}) {
+    PacketCrcPool pool(threads);
+    ASSERT(pool.crc16(p, data.size()) == expect);
+    ASSERT(pool.crc16(p, 1000) == crc_16(p, 1000));
+    ASSERT(pool.crc16(p, data.size()) == expect);
+  }
+
+  // 并发调用
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 5; j++) {
+        ASSERT(PacketCrcPool::instance().crc16(p, data.size()) == expect);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+#endif
+
+  // 打包和解包结果与串行相同
+  PacketProcessor serial;
+  serial.setUseCrc(true);
+  serial.setParallelCrcThreshold(0);
+  const auto frame = serial.pack(data);
+  int count = 0;
+  PacketProcessor parallel([&](uint8_t* payload, size_t size) {
+    ASSERT(std::string((char*)payload, size) == data);
+    count++;
+  });
+  parallel.setUseCrc(true);
+  parallel.setParallelCrcThreshold(256 * 1024);
+  parallel.setMaxBufferSize(data.size());
+  ASSERT(parallel.pack(data) == frame);
+  parallel.feed(frame.data(), frame.size());
+  ASSERT(count == 1);
+}
+
+static void testTrace() {
+  PacketProcessor_LOG("******test trace******");
+  // 区间上界与误差
+  for (uint64_t v : {0ull, 1ull, 15ull, 16ull, 17ull, 31ull, 32ull, 1000ull, 123456789ull, ~0ull}) {
+    const unsigned int b = PacketHistogram::bucketOf(v);
+    ASSERT(b < PacketHistogram::BUCKETS);
+    ASSERT(PacketHistogram::bucketUpper(b) >= v);
+    ASSERT(PacketHistogram::bucketUpper(b) - v <= v / PacketHistogram::SUB_BUCKETS);
+    if (b > 0) ASSERT(PacketHistogram::bucketUpper(b - 1) < v);
+  }
+
+  PacketHistogram h;
+  ASSERT(h.percentile(50) == 0);
+  for (uint64_t i = 1; i <= 10000; i++) {
+    h.record(i);
+  }
+  ASSERT(h.count() == 10000);
+  ASSERT(h.max() == 10000);
+  ASSERT(h.mean() == 5000.5);
+  for (double p : {50.0, 90.0, 99.0}) {
+    const double expect = p * 100;
+    ASSERT(h.percentile(p) >= expect && h.percentile(p) <= expect * (1 + 1.0 / PacketHistogram::SUB_BUCKETS));
+  }
+  ASSERT(h.percentile(100) == 10000);
+  h.reset();
+  ASSERT(h.count() == 0 && h.max() == 0);
+
+#ifdef PacketProcessor_ENABLE_TRACE
+  // 分两次到达的数据包 等待时间计入reassembly
+  PacketTrace::global().reset();
+  int count = 0;
+  PacketProcessor processor([&](uint8_t*, size_t) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    count++;
+  });
+  const auto frame = processor.pack(std::string(100, 'x'));
+  for (int i = 0; i < 10; i++) {
+    processor.feed(frame.data(), 20);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    processor.feed(frame.data() + 20, frame.size() - 20);
+  }
+  ASSERT(count == 10);
+  const auto& trace = PacketTrace::global();
+  for (int i = 0; i < PacketTrace::STAGE_COUNT; i++) {
+    ASSERT(trace.histogram((PacketTrace::Stage)i).count() == 10);
+  }
+  ASSERT(trace.histogram(PacketTrace::REASSEMBLY).percentile(50) >= 1000000);
+  ASSERT(trace.histogram(PacketTrace::HANDLER).percentile(50) >= 2000000);
+  ASSERT(trace.histogram(PacketTrace::TOTAL).percentile(50) >= 3000000);
+  PacketProcessor_LOG("trace:\n%s", trace.dump().c_str());
+
+  // feedv直接回调的数据包同样记录长度解析阶段
+  PacketTrace::global().reset();
+  struct iovec iov[] = {{(void*)frame.data(), frame.size()}};
+  for (int i = 0; i < 10; i++) {
+    processor.feedv(iov, 1);
+  }
+  ASSERT(count == 20);
+  ASSERT(trace.histogram(PacketTrace::LENGTH).count() == 10 && trace.histogram(PacketTrace::LENGTH).max() > 0);
+#endif
+}
+
+static void testWriter() {
+  PacketProcessor_LOG("******test writer******");
+  int count = 0;
+  PacketProcessor processor([&](uint8_t* data, size_t size) {
+    ASSERT(std::string((char*)data, size) == std::to_string(count));
+    count++;
+  });
+
+  std::vector<size_t> batches;
+  PacketWriter writer(processor, [&](const uint8_t* data, size_t size) {
+    batches.push_back(size);
+    processor.feed(data, size);
+  });
+  writer.setFlushSize(100);
+  writer.setFlushDelay(std::chrono::hours(1));
+
+  // 按字节数输出 每包11字节
+  for (int i = 0; i < 10; i++) {
+    writer.write(std::to_string(i));
+  }
+  ASSERT(batches.size() == 1 && batches[0] == 110);
+  ASSERT(count == 10);
+
+  // 主动输出
+  writer.write(std::to_string(10));
+  ASSERT(writer.pendingSize() == 12);
+  writer.flush();
+  ASSERT(batches.size() == 2 && count == 11);
+  ASSERT(writer.pendingSize() == 0);
+
+  // 按时间输出
+  writer.write(std::to_string(11));
+  writer.poll();
+  ASSERT(batches.size() == 2);
+  writer.poll(writer.deadline());
+  ASSERT(batches.size() == 3 && count == 12);
+  ASSERT(writer.deadline() == PacketWriter::Clock::time_point::max());
+
+  const auto& stats = writer.stats();
+  PacketProcessor_LOG("batches:%llu, avg frames:%.2f, avg bytes:%.2f, avg delay:%.2fus", (unsigned long long)stats.batches,
+                      stats.avgBatchFrames(), stats.avgBatchBytes(), stats.avgDelayUs());
+  ASSERT(stats.batches == 3 && stats.frames == 12);
+  ASSERT(stats.maxDelayUs >= 1000ull * 1000 * 3600);
+}
+
+static void testIndex() {
+  PacketProcessor_LOG("******test index******");
+  PacketProcessor processor;
+  std::string stream = "garbage";
+  for (uint32_t i = 0; i < 1000; i++) {
+    stream += processor.pack(std::to_string(i));
+    if (i % 100 == 0) stream += "\x5A\xA5noise";
+  }
+
+  PacketIndex index(processor);
+  index.setTimestampSampler(10, [](const uint8_t* data, size_t size) {
+    return (uint64_t)std::stoul(std::string((char*)data, size)) * 1000;
+  });
+  ASSERT(index.build(stream.data(), stream.size()) == stream.size());
+  ASSERT(index.size() == 1000);
+  ASSERT(index[0].offset == 7);
+  ASSERT(index.timeSamples().size() == 100);
+  ASSERT(index.findByOffset(0) == 0);
+  ASSERT(index.findByOffset(index[500].offset) == 500);
+  ASSERT(index.findByOffset(index[500].offset + 1) == 501);
+  ASSERT(index.findByOffset(stream.size()) == PacketIndex::npos);
+  ASSERT(index.findByTime(123456) == 120);
+  ASSERT(index.findByTime(999999999) == 990);
+
+  // 分块索引: 跨块的数据包留到下一块
+  const size_t split = index[3].offset + 3;
+  PacketIndex chunked(processor);
+  ASSERT(chunked.build(stream.data(), split) == index[3].offset);
+  ASSERT(chunked.size() == 3);
+  ASSERT(chunked.build(stream.data() + index[3].offset, index[4].offset - index[3].offset, index[3].offset) ==
+         index[4].offset - index[3].offset);
+  ASSERT(chunked.size() == 4 && chunked[3].offset == index[3].offset);
+
+  chunked.clear();
+  uint64_t offset = 0;
+  std::string carry;
+  for (size_t pos = 0; pos < stream.size(); pos += 777) {
+    std::string block = carry + stream.substr(pos, 777);
+    const size_t used = chunked.build(block.data(), block.size(), offset);
+    carry = block.substr(used);
+    offset += used;
+  }
+  ASSERT(carry.empty());
+  ASSERT(chunked.size() == index.size());
+
+  // 数据流结尾: 声明长度超出剩余字节的包头不阻止索引其后的数据包
+  std::string tail = stream.substr(0, index[50].offset);
+  tail += processor.pack(std::string(5000, 'y')).substr(0, 10);
+  tail += stream.substr(index[50].offset, index[100].offset - index[50].offset);
+  PacketIndex closed(processor);
+  ASSERT(closed.build(tail.data(), tail.size()) == index[50].offset);
+  ASSERT(closed.size() == 50);
+  closed.clear();
+  ASSERT(closed.build(tail.data(), tail.size(), 0, true) == tail.size());
+  ASSERT(closed.size() == 100);
+  for (size_t i = 0; i < index.size(); i++) {
+    ASSERT(chunked[i].offset == index[i].offset && chunked[i].size == index[i].size);
+  }
+
+  // 只解析片段
+  uint32_t next = 500;
+  PacketProcessor reader([&](uint8_t* data, size_t size) {
+    ASSERT(std::string((char*)data, size) == std::to_string(next));
+    next++;
+  });
+  ASSERT(index.replay(stream.data(), stream.size(), 500, 600, reader));
+  ASSERT(next == 600);
+
+  // 片段大于maxBufferSize 且不与残留的未完成数据拼接
+  reader.setMaxBufferSize(1024);
+  ASSERT(index.slice(100, 900).size > 1024);
+  reader.feed(stream.data() + index[10].offset, index[10].size - 1);
+  next = 100;
+  ASSERT(index.replay(stream.data(), stream.size(), 100, 900, reader));
+  ASSERT(next == 900);
+
+  // 边车文件
+  auto sidecar = index.serialize();
+  PacketProcessor_LOG("index size: %zu frames -> %zu bytes", index.size(), sidecar.size());
+  PacketIndex loaded(processor);
+  ASSERT(loaded.deserialize(sidecar.data(), sidecar.size()));
+  ASSERT(loaded.size() == index.size());
+  for (size_t i = 0; i < index.size(); i++) {
+    ASSERT(loaded[i].offset == index[i].offset && loaded[i].size == index[i].size);
+  }
+  ASSERT(loaded.findByTime(123456) == 120);
+  sidecar[sidecar.size() / 2] ^= 1;
+  ASSERT(!loaded.deserialize(sidecar.data(), sidecar.size()));
+}
+
+static void testCompactHeader() {
+  PacketProcessor_LOG("******test compact header******");
+  PacketProcessor classic;
+  PacketProcessor compact;
+  compact.setUseCompactHeader(true);
+
+  ASSERT(classic.pack("1234").size() == 4 + 10);
+  ASSERT(compact.pack("1234").size() == 4 + 6);
+  ASSERT(compact.pack(std::string(64, 'x')).size() == 64 + 7);
+  // 超过紧凑形式的上限时使用约定形式
+  ASSERT(compact.pack(std::string(PacketProcessor::COMPACT_MAX_SIZE, 'x')).size() == PacketProcessor::COMPACT_MAX_SIZE + 7);
+  ASSERT(compact.pack(std::string(PacketProcessor::COMPACT_MAX_SIZE + 1, 'x')) ==
+         classic.pack(std::string(PacketProcessor::COMPACT_MAX_SIZE + 1, 'x')));
+
+  // 长度只接受最短的varint编码 且不超过上限
+  {
+    int got = 0;
+    PacketProcessor strict([&](uint8_t*, size_t) {
+      got++;
+    });
+    strict.setAcceptCompactHeader(true);
+    const std::string canonical = compact.pack("x");
+    ASSERT(canonical.size() == 7 && (uint8_t)canonical[2] == 0x02);
+    std::string overlong = canonical.substr(0, 2) + std::string("\x82\x00", 2);
+    overlong.push_back((char)(crc_16((uint8_t*)overlong.data() + 2, 2) & 0xff));
+    overlong += canonical.substr(4);
+    strict.feed(overlong.data(), overlong.size());
+    ASSERT(got == 0);
+    std::string tooLong = canonical.substr(0, 2) + "\x80\x80\x01";
+    strict.feed(tooLong.data(), tooLong.size());
+    ASSERT(got == 0 && strict.pendingSize() == 0);
+    strict.feed(canonical.data(), canonical.size());
+    ASSERT(got == 1);
+  }
+
+  // 两种形式混合 并穿插错误数据
+  std::vector<std::string> expect;
+  std::string stream;
+  for (int i = 0; i < 300; i++) {
+    std::string data = std::string(i, 'a' + i % 26) + std::to_string(i);
+    expect.push_back(data);
+    stream += (i % 3 ? compact : classic).pack(data);
+    if (i % 50 == 0) stream += "\x5A\xC3\x81";
+    if (i % 70 == 0) stream += std::string("\x5A\xC3\x08\x00", 4);
+  }
+
+  size_t count = 0;
+  PacketProcessor processor([&](uint8_t* data, size_t size) {
+    ASSERT(std::string((char*)data, size) == expect[count]);
+    count++;
+  });
+  processor.setAcceptCompactHeader(true);
+  processor.feed(stream.data(), stream.size());
+  ASSERT(count == expect.size());
+
+  count = 0;
+  std::default_random_engine generator(time(nullptr));
+  std::uniform_int_distribution<int> dis(1, 10);
+  for (size_t sent = 0; sent < stream.size();) {
+    size_t n = std::min<size_t>(dis(generator), stream.size() - sent);
+    processor.feed(stream.data() + sent, n);
+    sent += n;
+  }
+  ASSERT(count == expect.size());
+
+  PacketIndex index(processor);
+  ASSERT(index.build(stream.data(), stream.size()) == stream.size());
+  ASSERT(index.size() == expect.size());
+
+  // 默认只识别约定形式 其中形似紧凑包头的错误数据不影响后续数据包
+  {
+    const std::string varint("\xC0\x3E", 2);  // 4000 << 1
+    std::string stray = "\x5A\xC3" + varint;
+    stray.push_back((char)(crc_16((uint8_t*)varint.data(), varint.size()) & 0xff));
+    std::string classicStream;
+    for (int i = 0; i < 100; i++) {
+      if (i == 50) classicStream += stray;
+      classicStream += classic.pack(std::to_string(i));
+    }
+    int got = 0;
+    PacketProcessor classicOnly([&](uint8_t*, size_t) {
+      got++;
+    });
+    classicOnly.feed(classicStream.data(), classicStream.size());
+    ASSERT(got == 100);
+    PacketIndex classicIndex(classicOnly);
+    ASSERT(classicIndex.build(classicStream.data(), classicStream.size()) == classicStream.size());
+    ASSERT(classicIndex.size() == 100);
+  }
+
+  // 压缩及数据CRC
+  compact.setUseCompress(true);
+  compact.setUseCrc(true);
+  processor.setUseCrc(true);
+  count = 0;
+  expect = {std::string(1000, 'z')};
+  auto payload = compact.pack(expect[0]);
+#ifndef PacketProcessor_DISABLE_COMPRESS
+  ASSERT(payload.size() < 100);
+#endif
+  processor.feed(payload.data(), payload.size());
+  ASSERT(count == 1);
+}
+
+static void onStaticPacket(void* ctx, uint8_t* data, size_t size) {
+  static_cast<std::vector<std::string>*>(ctx)->emplace_back((char*)data, size);
+}
+
+static void testStatic() {
+  PacketProcessor_LOG("******test static******");
+  const size_t BUFFER_SIZE = 4096;
+  const size_t SCRATCH_SIZE = 4096;
+  std::default_random_engine generator(time(nullptr));
+
+  // 混合紧凑包头、压缩、损坏和超长数据包
+  std::string stream;
+  size_t compressedFrames = 0;
+  for (int i = 0; i < 2000; i++) {
+    PacketProcessor packer;
+    packer.setUseCompactHeader(generator() % 2);
+    packer.setUseCompress(generator() % 2);
+    std::string data;
+    const size_t size = generator() % 10 == 0 ? BUFFER_SIZE + generator() % 100 : 1 + generator() % 2000;
+    for (size_t j = 0; j < size; j++) {
+      data.push_back((char)(generator() % 4 == 0 ? generator() : j % 13));
+    }
+    auto frame = packer.pack(data);
+    ASSERT(frame.size() <= data.size() + 10);
+
+    // packTo与pack逐字节相同
+    std::vector<uint8_t> out(data.size() + 10);
+    ASSERT(packer.packTo(data.data(), data.size(), out.data(), out.size()) == frame.size());
+    ASSERT(memcmp(out.data(), frame.data(), frame.size()) == 0);
+    ASSERT(packer.packTo(data.data(), data.size(), out.data(), out.size() - 1) == 0);
+
+    if (frame.size() < data.size() + 10) compressedFrames++;
+    if (generator() % 10 == 0) frame[generator() % frame.size()] ^= 0x20;
+    stream += frame;
+  }
+  PacketProcessor_LOG("compressed frames: %zu", compressedFrames);
+
+  // 与默认的堆模式结果一致
+  std::vector<std::string> expect;
+  PacketProcessor processor([&](uint8_t* data, size_t size) {
+    expect.emplace_back((char*)data, size);
+  });
+  processor.setMaxBufferSize(BUFFER_SIZE - 10);
+  std::vector<std::string> got;
+  std::unique_ptr<StaticPacketProcessor<BUFFER_SIZE, SCRATCH_SIZE>> staticProcessor(
+      new StaticPacketProcessor<BUFFER_SIZE, SCRATCH_SIZE>(onStaticPacket, &got));
+  processor.setAcceptCompactHeader(true);
+  staticProcessor->setAcceptCompactHeader(true);
+  for (size_t sent = 0; sent < stream.size();) {
+    size_t n = std::min<size_t>(1 + generator() % 3000, stream.size() - sent);
+    processor.feed(stream.data() + sent, n);
+    staticProcessor->feed(stream.data() + sent, n);
+    sent += n;
+  }
+  PacketProcessor_LOG("frames: %zu", expect.size());
+  ASSERT(!expect.empty());
+  ASSERT(got == expect);
+  ASSERT(staticProcessor->bufferCapacity() == BUFFER_SIZE + SCRATCH_SIZE);
+
+  // 无解压缓存时丢弃压缩的数据包
+  PacketProcessor packer;
+  packer.setUseCompress(true);
+  const std::string compressible(1000, 'x');
+  got.clear();
+  StaticPacketProcessor<BUFFER_SIZE> noScratch(onStaticPacket, &got);
+  auto frame = packer.pack(compressible);
+  noScratch.feed(frame.data(), frame.size());
+  frame = PacketProcessor().pack(compressible);
+  noScratch.feed(frame.data(), frame.size());
+#ifndef PacketProcessor_DISABLE_COMPRESS
+  ASSERT(got.size() == 1 && got[0] == compressible);
+#else
+  ASSERT(got.size() == 2 && got[0] == compressible);
+#endif
+
+  // 复制外部内存模式的processor时数据复制到堆上 与原对象互不影响
+  uint8_t memory[64];
+  std::vector<std::string> packets;
+  PacketProcessor original([&](uint8_t* data, size_t size) {
+    packets.emplace_back((char*)data, size);
+  });
+  original.setBuffer(memory, sizeof(memory));
+  const auto hello = packer.pack("hello");
+  const auto world = packer.pack("world");
+  original.feed(hello.data(), hello.size() - 1);
+  PacketProcessor copy(original);
+  ASSERT(copy.releasableCapacity() > 0 && original.releasableCapacity() == 0);
+  original.feed(hello.data() + hello.size() - 1, 1);
+  original.feed(world.data(), world.size() - 1);
+  copy.feed(hello.data() + hello.size() - 1, 1);
+  ASSERT(packets.size() == 2 && packets[0] == "hello" && packets[1] == "hello");
+}
+
+static void testEviction() {
+  PacketProcessor_LOG("******test eviction******");
+  int count = 0;
+  PacketProcessor processor([&](uint8_t*, size_t) {
+    count++;
+  });
+  processor.setPartialTimeout(std::chrono::seconds(1));
+  const auto frame = processor.pack(std::string(10000, 'x'));
+
+  // 完整到达的数据包不计时
+  processor.feed(frame.data(), frame.size() / 2);
+  ASSERT(processor.partialSince() != PacketProcessor::Clock::time_point());
+  processor.feed(frame.data() + frame.size() / 2, frame.size() - frame.size() / 2);
+  ASSERT(count == 1);
+  ASSERT(processor.partialSince() == PacketProcessor::Clock::time_point());
+  ASSERT(!processor.poll(PacketProcessor::Clock::now() + std::chrono::hours(1)));
+
+  // 超时丢弃并释放缓存
+  processor.feed(frame.data(), frame.size() / 2);
+  const auto since = processor.partialSince();
+  ASSERT(!processor.poll(since + std::chrono::milliseconds(999)));
+  ASSERT(processor.poll(since + std::chrono::seconds(1)));
+  ASSERT(processor.evictions() == 1);
+  ASSERT(processor.pendingSize() == 0);
+  ASSERT(processor.bufferCapacity() == 0);
+  processor.feed(frame.data(), frame.size());
+  ASSERT(count == 2);
+
+  // 持续收到数据时重新计时
+  processor.feed(frame.data(), frame.size() / 4);
+  const auto first = processor.partialSince();
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  processor.feed(frame.data() + frame.size() / 4, frame.size() / 4);
+  ASSERT(processor.partialSince() > first);
+  ASSERT(!processor.poll(first + std::chrono::seconds(1)));
+  processor.feed(frame.data() + frame.size() / 4 * 2, frame.size() - frame.size() / 4 * 2);
+  ASSERT(count == 3);
+
+  // 内存上限: 从最久没有进展的未完成数据包开始丢弃
+  PacketProcessor processors[3];
+  PacketGovernor governor;
+  for (auto& p : processors) {
+    governor.add(&p);
+    p.feed(frame.data(), frame.size() - 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT(governor.size() == 3);
+  ASSERT(governor.poll() == 0);
+  governor.setMemoryLimit(governor.memoryUsage() - 1);
+  ASSERT(governor.poll() == 1);
+  ASSERT(governor.stats().evicted == 1);
+  ASSERT(processors[0].pendingSize() == 0 && processors[0].evictions() == 1);
+  ASSERT(processors[1].pendingSize() == frame.size() - 1);
+  ASSERT(processors[2].pendingSize() == frame.size() - 1);
+
+  // 超时
+  governor.setPartialTimeout(std::chrono::seconds(10));
+  ASSERT(governor.poll() == 0);
+  ASSERT(governor.poll(PacketProcessor::Clock::now() + std::chrono::seconds(10)) == 2);
+  ASSERT(governor.stats().expired == 2);
+  ASSERT(governor.memoryUsage() == 0);
+
+  // 外部内存不计入也不会被丢弃 不影响其它processor
+  std::vector<uint8_t> storage(frame.size());
+  PacketProcessor external;
+  external.setBuffer(storage.data(), storage.size());
+  governor.add(&external);
+  external.feed(frame.data(), frame.size() - 1);
+  processors[0].feed(frame.data(), frame.size() - 1);
+  processors[1].feed(frame.data(), frame.size() - 1);
+  ASSERT(external.releasableCapacity() == 0);
+  governor.setMemoryLimit(governor.memoryUsage() - 1);
+  ASSERT(governor.poll() == 1);
+  ASSERT(external.pendingSize() == frame.size() - 1 && external.evictions() == 0);
+  ASSERT(processors[0].pendingSize() == 0);
+  ASSERT(processors[1].pendingSize() == frame.size() - 1);
+  governor.remove(&external);
+
+  for (auto& p : processors) {
+    governor.remove(&p);
+  }
+  ASSERT(governor.size() == 0);
+}
+
+static void testFeedv() {
+  PacketProcessor_LOG("******test feedv******");
+  PacketProcessor classic;
+  PacketProcessor compact;
+  PacketProcessor compress;
+  compact.setUseCompactHeader(true);
+  compress.setUseCompress(true);
+
+  // 混合各种形式 并穿插错误数据、相似包头及损坏的数据包
+  std::default_random_engine generator(time(nullptr));
+  std::string stream;
+  for (int i = 0; i < 500; i++) {
+    std::string data = std::string(generator() % 3000, 'a' + i % 26) + std::to_string(i);
+    PacketProcessor* packers[] = {&classic, &compact, &compress};
+    std::string frame = packers[i % 3]->pack(data);
+    if (i % 37 == 0) frame[frame.size() / 2] ^= 0x01;
+    stream += frame;
+    if (i % 11 == 0) stream += "\x5A";
+    if (i % 13 == 0) stream += std::string("\x5A\xA5\x00\x00", 4);
+    if (i % 17 == 0) stream += "\x5A\xC3\x81";
+    if (i % 19 == 0) stream += "junk";
+  }
+  stream += classic.pack("end");
+
+  // 与逐段feed比较 段长度从1字节到整包不等
+  std::vector<std::string> expect, actual;
+  PacketProcessor reference([&](uint8_t* data, size_t size) {
+    expect.emplace_back((char*)data, size);
+  });
+  PacketProcessor processor([&](uint8_t* data, size_t size) {
+    actual.emplace_back((char*)data, size);
+  });
+  reference.setAcceptCompactHeader(true);
+  processor.setAcceptCompactHeader(true);
+  const size_t maxChunks[] = {1, 3, 100, 10000, 100000};
+  for (size_t maxChunk : maxChunks) {
+    std::vector<struct iovec> iov;
+    for (size_t sent = 0; sent < stream.size();) {
+      size_t n = std::min<size_t>(generator() % maxChunk + 1, stream.size() - sent);
+      reference.feed(stream.data() + sent, n);
+      iov.push_back({(void*)(stream.data() + sent), n});
+      sent += n;
+    }
+    for (size_t i = 0; i < iov.size();) {
+      size_t n = std::min<size_t>(generator() % 8 + 1, iov.size() - i);
+      processor.feedv(iov.data() + i, n);
+      i += n;
+    }
+    ASSERT(expect.back() == "end");
+    ASSERT(actual == expect);
+    expect.clear();
+    actual.clear();
+  }
+
+  // 完整位于一段内的数据包直接回调 不经过缓存
+  const std::string a = classic.pack("aaa") + compact.pack("bbb");
+  const std::string b = classic.pack(std::string(1000, 'c'));
+  std::vector<const uint8_t*> pointers;
+  PacketProcessor direct([&](uint8_t* data, size_t) {
+    pointers.push_back(data);
+  });
+  direct.setAcceptCompactHeader(true);
+  struct iovec aligned[] = {{(void*)a.data(), a.size()}, {(void*)b.data(), b.size()}};
+  direct.feedv(aligned, 2);
+  ASSERT(pointers.size() == 3);
+  ASSERT(pointers[0] == (uint8_t*)a.data() + 6 + 2);
+  ASSERT(pointers[1] > (uint8_t*)a.data() && pointers[1] < (uint8_t*)a.data() + a.size());
+  ASSERT(pointers[2] == (uint8_t*)b.data() + 6 + 2);
+  ASSERT(direct.bufferCapacity() == 0);
+
+  // 跨段的数据包只缓存自身 长度已知后一次分配整包大小
+  pointers.clear();
+  const size_t third = b.size() / 3;
+  struct iovec split[] = {{(void*)a.data(), a.size()},
+                          {(void*)b.data(), third},
+                          {(void*)(b.data() + third), third},
+                          {(void*)(b.data() + third * 2), b.size() - third * 2},
+                          {(void*)a.data(), a.size()}};
+  direct.feedv(split, 5);
+  ASSERT(pointers.size() == 5);
+  ASSERT(pointers[0] == (uint8_t*)a.data() + 6 + 2);
+  ASSERT(pointers[3] == (uint8_t*)a.data() + 6 + 2);
+  ASSERT(direct.bufferCapacity() == b.size());
+  ASSERT(direct.pendingSize() == 0);
+
+  // 外部缓存放不下的数据包与feed相同地丢弃 不越界写入 之后的数据包正常解出
+  uint8_t memory[64], memoryFeed[64];
+  std::vector<std::string> fed, vectored;
+  PacketProcessor small([&](uint8_t* data, size_t size) {
+    vectored.emplace_back((char*)data, size);
+  });
+  small.setBuffer(memory, sizeof(memory));
+  PacketProcessor smallFeed([&](uint8_t* data, size_t size) {
+    fed.emplace_back((char*)data, size);
+  });
+  smallFeed.setBuffer(memoryFeed, sizeof(memoryFeed));
+  const std::string big = classic.pack(std::string(200, 'b'));
+  const std::string tail = big.substr(100) + classic.pack("after");
+  smallFeed.feed(big.data(), 100);
+  smallFeed.feed(tail.data(), tail.size());
+  struct iovec overflow[] = {{(void*)big.data(), 100}, {(void*)tail.data(), tail.size()}};
+  small.feedv(overflow, 2);
+  ASSERT(vectored == fed);
+  ASSERT(vectored.size() == 1 && vectored[0] == "after");
+}
+
+static void testPackInPlace() {
+  PacketProcessor_LOG("******test pack in place******");
+  for (int compact = 0; compact < 2; compact++) {
+    for (int useCrc = 0; useCrc < 2; useCrc++) {
+      PacketProcessor processor;
+      processor.setUseCompactHeader(compact);
+      processor.setUseCrc(useCrc);
+
+      PacketBuffer buffer(processor, 16);
+      for (uint32_t size : {1u, 5u, 63u, 64u, 1000u, 100000u}) {
+        std::string data;
+        for (uint32_t i = 0; i < size; i++) data.push_back((char)(i * 7));
+        memcpy(buffer.payload(size), data.data(), size);
+        ASSERT(buffer.capacity() >= size);
+        buffer.finalize(size);
+        ASSERT(std::string((char*)buffer.data(), buffer.size()) == processor.pack(data));
+      }
+    }
+  }
+}
+
+#pragma pack(push, 1)
+struct TestPoint {
+  int32_t x;
+  int32_t y;
+};
+#pragma pack(pop)
+
+static int routePoints = 0;
+static std::string routeText;
+
+static void onTestPoint(const TestPoint& p, MessageView tail) {
+  ASSERT(p.x == routePoints && p.y == -routePoints);
+  ASSERT(tail.size() == 0);
+  routePoints++;
+}
+
+static uint32_t routeValue = 0;
+
+static void onTestValue(const uint32_t& v, MessageView) {
+  routeValue = v;
+}
+
+static void onTestText(MessageView view) {
+  routeText.assign((char*)view.data(), view.size());
+}
+
+struct TestRouteCounter {
+  int count = 0;
+  void onMessage(MessageView view) {
+    uint32_t v = 0;
+    ASSERT(view.read(v));
+    ASSERT(!view.read(v, 1));
+    ASSERT(view.as<uint32_t>(1) == nullptr);
+    count += v;
+  }
+};
+
+static void testRouter() {
+  PacketProcessor_LOG("******test router******");
+  PacketProcessor processor;
+  PacketRouter router;
+  router.attach(processor);
+
+  TestRouteCounter counter;
+  int runtime = 0;
+  router.route<TestPoint, onTestPoint>(1);
+  router.route<onTestText>(2);
+  router.route<uint32_t, onTestValue>(6);
+  router.route<TestRouteCounter, &TestRouteCounter::onMessage>(3, &counter);
+  router.route(
+      4,
+      [](void* ctx, MessageView) {
+        (*(int*)ctx)++;
+      },
+      &runtime);
+
+  auto send = [&](uint8_t type, const void* data, size_t size) {
+    std::string msg(1, (char)type);
+    msg.append((char*)data, size);
+    auto payload = processor.pack(msg);
+    processor.feed(payload.data(), payload.size());
+  };
+
+  for (int i = 0; i < 10; i++) {
+    TestPoint p{i, -i};
+    send(1, &p, sizeof(p));
+  }
+  ASSERT(routePoints == 10);
+  send(1, "123", 3);
+  ASSERT(router.malformed() == 1);
+
+  send(2, "hello", 5);
+  ASSERT(routeText == "hello");
+
+  uint32_t v = 7;
+  send(3, &v, sizeof(v));
+  send(3, &v, sizeof(v));
+  ASSERT(counter.count == 14);
+
+  send(4, "", 0);
+  ASSERT(runtime == 1);
+
+  // 类型字节之后的数据未对齐 对齐要求大于1的消息拷贝后回调
+  v = 0x12345678;
+  send(6, &v, sizeof(v));
+  ASSERT(routeValue == v && router.malformed() == 1);
+
+  send(5, "x", 1);
+  ASSERT(router.dropped() == 1);
+  router.route(4, nullptr);
+  send(4, "", 0);
+  ASSERT(runtime == 1 && router.dropped() == 2);
+}
+
+#ifdef PacketProcessor_WITH_ENGINE
+static void testEngine() {
+  PacketProcessor_LOG("******test engine******");
+  const int CONNECTIONS = 64;
+  const uint32_t FRAMES = 200;
+
+  PacketEngine engine(4);
+  std::vector<uint32_t> next(CONNECTIONS, 0);
+  std::vector<PacketEngine::Connection*> connections;
+  for (int i = 0; i < CONNECTIONS; i++) {
+    connections.push_back(engine.addConnection(std::unique_ptr<PacketProcessor>(new PacketProcessor([&next, i](uint8_t* data, size_t size) {
+      ASSERT(std::string((char*)data, size) == std::to_string(next[i]));
+      next[i]++;
+    }))));
+  }
+
+  PacketProcessor packer;
+  std::vector<std::string> streams(CONNECTIONS);
+  for (int i = 0; i < CONNECTIONS; i++) {
+    for (uint32_t f = 0; f < FRAMES; f++) {
+      streams[i] += packer.pack(std::to_string(f));
+    }
+  }
+
+  // 交错送入随机大小的数据块
+  std::default_random_engine generator(time(nullptr));
+  std::uniform_int_distribution<int> dis(1, 64);
+  std::vector<size_t> sent(CONNECTIONS, 0);
+  bool remain = true;
+  while (remain) {
+    remain = false;
+    for (int i = 0; i < CONNECTIONS; i++) {
+      size_t n = std::min<size_t>(dis(generator), streams[i].size() - sent[i]);
+      engine.feed(connections[i], streams[i].data() + sent[i], n);
+      sent[i] += n;
+      remain = remain || sent[i] < streams[i].size();
+    }
+  }
+  engine.wait();
+
+  for (int i = 0; i < CONNECTIONS; i++) {
+    ASSERT(next[i] == FRAMES);
+    engine.removeConnection(connections[i]);
+  }
+
+  uint64_t bytes = 0;
+  auto stats = engine.stats();
+  for (size_t i = 0; i < stats.size(); i++) {
+    PacketProcessor_LOG("shard %zu: bytes=%llu, batches=%llu, steals=%llu, stolen=%llu", i, (unsigned long long)stats[i].bytes,
+                        (unsigned long long)stats[i].batches, (unsigned long long)stats[i].steals, (unsigned long long)stats[i].stolen);
+    bytes += stats[i].bytes;
+  }
+  ASSERT(bytes == streams[0].size() * CONNECTIONS);
+
+  // 分片繁忙时空闲线程窃取连接 积压处理完后连接回到所属分片
+  PacketEngine pair(2);
+  std::atomic<bool> releaseA{false}, releaseB{false};
+  std::atomic<int> blocked{0}, got{0};
+  auto a = pair.addConnection(std::unique_ptr<PacketProcessor>(new PacketProcessor([&](uint8_t*, size_t) {
+    blocked++;
+    while (!releaseA) std::this_thread::yield();
+  })));
+  auto b = pair.addConnection(std::unique_ptr<PacketProcessor>(new PacketProcessor([&](uint8_t*, size_t) {
+    blocked++;
+    while (!releaseB) std::this_thread::yield();
+  })));
+  auto c = pair.addConnection(std::unique_ptr<PacketProcessor>(new PacketProcessor([&](uint8_t*, size_t) {
+    got++;
+  })));
+  const auto frame = packer.pack("x");
+  pair.feed(a, frame.data(), frame.size());
+  while (blocked != 1) std::this_thread::yield();
+  pair.feed(c, frame.data(), frame.size());
+  while (got != 1) std::this_thread::yield();
+  ASSERT(pair.stats()[1].steals == 1 && pair.stats()[0].stolen == 1);
+  releaseA = true;
+  pair.wait();
+
+  pair.feed(b, frame.data(), frame.size());
+  while (blocked != 2) std::this_thread::yield();
+  const auto homeBytes = pair.stats()[0].bytes;
+  pair.feed(c, frame.data(), frame.size());
+  while (got != 2) std::this_thread::yield();
+  releaseB = true;
+  pair.wait();
+  ASSERT(pair.stats()[0].steals == 0 && pair.stats()[1].steals == 1);
+  ASSERT(pair.stats()[0].bytes == homeBytes + frame.size());
+}
+#endif
+
+#ifdef PacketProcessor_WITH_SHM
+static void testShmRing() {
+  PacketProcessor_LOG("******test shm ring******");
+  const std::string NAME = "/PacketProcessor_test_" + std::to_string(getpid());
+  PacketShmRing writer;
+  ASSERT(writer.create(NAME, 4096, true));
+  PacketShmRing reader;
+  ASSERT(reader.open(NAME));
+
+  // 读写位置被破坏时丢弃全部数据 不越过数据区读取 (Header位于第一页 head在第二个缓存行)
+  int fd = shm_open(NAME.c_str(), O_RDWR, 0);
+  ASSERT(fd >= 0);
+  auto page = (uint8_t*)mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ASSERT(page != MAP_FAILED);
+  close(fd);
+  auto head = (std::atomic<uint64_t>*)(page + 64);
+  ASSERT(writer.write("x", 1));
+  head->store(head->load() + reader.capacity() * 3);
+  ASSERT(reader.poll(nullptr, 0) == 0);
+  ASSERT(reader.stats().errors == 1 && reader.pendingSize() == 0);
+  munmap(page, 4096);
+  PacketShmRing::unlink(NAME);
+  ASSERT(!PacketShmRing().open(NAME));
+  ASSERT(reader.capacity() == writer.capacity() && reader.capacity() >= 4096);
+
+  // 环中为约定形式的数据包 跨越环尾的数据包读取端也是连续的
+  std::default_random_engine generator(time(nullptr));
+  int written = 0;
+  int count = 0;
+  auto expect = [](int i) {
+    return std::string(1 + i * 37 % 1000, (char)i);
+  };
+  for (int round = 0; round < 200; round++) {
+    while (true) {
+      const auto data = expect(written);
+      if (!writer.write(data.data(), data.size(), 0)) break;
+      written++;
+    }
+    ASSERT(writer.pendingSize() > 0);
+    if (generator() % 2) {
+      reader.poll([&](const uint8_t* data, size_t size) {
+        ASSERT(std::string((char*)data, size) == expect(count));
+        count++;
+      });
+    } else {
+      size_t size;
+      while (const uint8_t* data = reader.peek(&size)) {
+        ASSERT(std::string((char*)data, size) == expect(count));
+        count++;
+        reader.release();
+      }
+    }
+    ASSERT(count == written);
+    ASSERT(reader.pendingSize() == 0);
+  }
+  ASSERT(reader.poll(nullptr, 0) == 0);
+  ASSERT(!writer.write(std::string(writer.maxPacketSize() + 1, 'x').data(), writer.maxPacketSize() + 1, 0));
+  ASSERT(reader.stats().errors == 1);
+
+  // 拒绝空数据包 不影响其前后的数据包
+  std::string got;
+  ASSERT(writer.write("a", 1));
+  ASSERT(!writer.write("", 0));
+  ASSERT(writer.write("b", 1));
+  ASSERT(reader.poll([&](const uint8_t* data, size_t size) {
+    got.append((char*)data, size);
+  }) == 2);
+  ASSERT(got == "ab" && reader.stats().errors == 1);
+
+  // 阻塞读写: 写入端远快于读取端时等待空间 读取端空闲时等待数据
+  const int FRAMES = 20000;
+  count = 0;
+  std::thread producer([&] {
+    for (int i = 0; i < FRAMES; i++) {
+      const auto data = expect(i);
+      ASSERT(writer.write(data.data(), data.size()));
+    }
+  });
+  while (count < FRAMES) {
+    reader.poll(
+        [&](const uint8_t* data, size_t size) {
+          ASSERT(std::string((char*)data, size) == expect(count));
+          count++;
+        },
+        1000);
+  }
+  producer.join();
+  PacketProcessor_LOG("writer waits:%llu, wakeups:%llu, reader waits:%llu, wakeups:%llu", (unsigned long long)writer.stats().waits,
+                      (unsigned long long)writer.stats().wakeups, (unsigned long long)reader.stats().waits,
+                      (unsigned long long)reader.stats().wakeups);
+}
+#endif
+
+#ifdef PacketProcessor_WITH_URING
+static void testUringReader() {
+  PacketProcessor_LOG("******test uring reader******");
+  PacketUringReader reader(64, 4096);
+  if (!reader.valid()) {
+    PacketProcessor_LOG("io_uring not supported, skip");
+    return;
+  }
+
+  // socketpair使用multishot recv 管道使用read
+  const int SOCKETS = 8;
+  const int PIPES = 2;
+  const int FRAMES = 200;
+  struct Peer {
+    int readFd = -1;
+    int writeFd = -1;
+    int count = 0;
+    int closed = -1;
+    std::unique_ptr<PacketProcessor> processor;
+  };
+  std::vector<Peer> peers(SOCKETS + PIPES);
+  for (int i = 0; i < SOCKETS + PIPES; i++) {
+    auto& peer = peers[i];
+    int fds[2];
+    if (i < SOCKETS) {
+      ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    } else {
+      ASSERT(pipe(fds) == 0);
+    }
+    peer.readFd = fds[0];
+    peer.writeFd = fds[1];
+    peer.processor.reset(new PacketProcessor([&peer](uint8_t* data, size_t size) {
+      ASSERT(std::string((char*)data, size) == std::to_string(peer.readFd) + ":" + std::to_string(peer.count));
+      peer.count++;
+    }));
+    ASSERT(reader.add(peer.readFd, peer.processor.get()));
+  }
+  ASSERT(!reader.add(peers[0].readFd, peers[0].processor.get()));
+  ASSERT(reader.size() == peers.size());
+  reader.setOnCloseHandle([&](int fd, int error) {
+    for (auto& peer : peers) {
+      if (peer.readFd == fd) peer.closed = error;
+    }
+  });
+
+  // 交错写入 按任意长度切分
+  std::default_random_engine generator(time(nullptr));
+  for (auto& peer : peers) {
+    std::string stream;
+    for (int i = 0; i < FRAMES; i++) {
+      stream += peer.processor->pack(std::to_string(peer.readFd) + ":" + std::to_string(i));
+    }
+    for (size_t sent = 0; sent < stream.size();) {
+      size_t n = std::min<size_t>(1 + generator() % 100, stream.size() - sent);
+      ASSERT(write(peer.writeFd, stream.data() + sent, n) == (ssize_t)n);
+      sent += n;
+      reader.poll(0);
+    }
+    close(peer.writeFd);
+  }
+
+  // 读完并收到关闭
+  for (int i = 0; i < 1000; i++) {
+    bool done = true;
+    for (auto& peer : peers) {
+      if (peer.closed < 0) done = false;
+    }
+    if (done) break;
+    reader.poll(10);
+  }
+  for (auto& peer : peers) {
+    ASSERT(peer.count == FRAMES);
+    ASSERT(peer.closed == 0);
+    reader.remove(peer.readFd);
+    close(peer.readFd);
+  }
+  ASSERT(reader.size() == 0);
+
+  // 读取请求未结束时remove 之后的数据不再送入processor
+  int fds[2];
+  int count = 0;
+  ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  PacketProcessor processor([&](uint8_t*, size_t) {
+    count++;
+  });
+  ASSERT(reader.add(fds[0], &processor));
+  reader.poll(0);
+  reader.remove(fds[0]);
+  const auto frame = processor.pack("removed");
+  ASSERT(write(fds[1], frame.data(), frame.size()) == (ssize_t)frame.size());
+  reader.poll(10);
+  reader.poll(0);
+  ASSERT(count == 0);
+  close(fds[0]);
+  close(fds[1]);
+  PacketProcessor_LOG("completions: %llu, submits: %llu", (unsigned long long)reader.stats().completions,
+                      (unsigned long long)reader.stats().submits);
+}
+#endif
+
 int main() {
   simpleUsage();
   testCommon();
   testSerious();
+#ifndef PacketProcessor_DISABLE_COMPRESS
+  testCompress();
+#endif
+  testParallelCrc();
+  testTrace();
+  testWriter();
+  testIndex();
+  testCompactHeader();
+  testRouter();
+  testPackInPlace();
+  testStatic();
+  testEviction();
+  testFeedv();
+#ifdef PacketProcessor_WITH_ENGINE
+  testEngine();
+#endif
+#ifdef PacketProcessor_WITH_SHM
+  testShmRing();
+#endif
+#ifdef PacketProcessor_WITH_URING
+  testUringReader();
+#endif
   return 0;
 }
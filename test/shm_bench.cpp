@@ -0,0 +1,202 @@
+/**
+ * 进程间传输基准: 父子两个进程 比较PacketShmRing与UNIX socketpair
+ * 吞吐: 父进程连续写入 子进程读取计数 读完后回复一个数据包
+ * 延迟: 父进程发送 子进程原样回复 统计往返时间
+ * 用法: PacketProcessor_shm_bench [数据包数] [数据长度]
+ */
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "PacketProcessor.h"
+#include "PacketShmRing.h"
+#include "assert_def.h"
+#include "log.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * 单向通道 send打包写入 recv阻塞直到至少收到一个数据包
+ */
+class Channel {
+ public:
+  virtual ~Channel() = default;
+  virtual void send(const void* data, uint32_t size) = 0;
+  virtual void recv(const std::function<void(const uint8_t* data, size_t size)>& handle) = 0;
+};
+
+class ShmChannel : public Channel {
+ public:
+  ShmChannel(PacketShmRing* out, PacketShmRing* in) : out_(out), in_(in) {}
+
+  void send(const void* data, uint32_t size) override {
+    ASSERT(out_->write(data, size));
+  }
+
+  void recv(const std::function<void(const uint8_t* data, size_t size)>& handle) override {
+    while (in_->poll(handle) == 0) {
+    }
+  }
+
+ private:
+  PacketShmRing* out_;
+  PacketShmRing* in_;
+};
+
+class SocketChannel : public Channel {
+ public:
+  explicit SocketChannel(int fd) : fd_(fd), buffer_(64 * 1024) {}
+
+  void send(const void* data, uint32_t size) override {
+    packer_.packForeach(data, size, [&](uint8_t* p, size_t n) {
+      pending_.insert(pending_.end(), p, p + n);
+    });
+    for (size_t sent = 0; sent < pending_.size();) {
+      ssize_t n = write(fd_, pending_.data() + sent, pending_.size() - sent);
+      ASSERT(n > 0);
+      sent += n;
+    }
+    pending_.clear();
+  }
+
+  void recv(const std::function<void(const uint8_t* data, size_t size)>& handle) override {
+    size_t count = 0;
+    unpacker_.setOnPacketHandle([&](uint8_t* data, size_t size) {
+      handle(data, size);
+      count++;
+    });
+    while (count == 0) {
+      ssize_t n = read(fd_, buffer_.data(), buffer_.size());
+      ASSERT(n > 0);
+      unpacker_.feed(buffer_.data(), n);
+    }
+  }
+
+ private:
+  int fd_;
+  PacketProcessor packer_;
+  PacketProcessor unpacker_;
+  std::vector<uint8_t> pending_;
+  std::vector<uint8_t> buffer_;
+};
+
+struct Options {
+  int frames = 1000000;
+  int payload = 64;
+  int pings = 100000;
+};
+
+/**
+ * 子进程: 先接收吞吐测试的数据包 再回显延迟测试的数据包
+ */
+static void runChild(Channel& channel, const Options& options) {
+  int count = 0;
+  while (count < options.frames) {
+    channel.recv([&](const uint8_t*, size_t) {
+      count++;
+    });
+  }
+  channel.send(&count, sizeof(count));
+
+  for (int i = 0; i < options.pings;) {
+    channel.recv([&](const uint8_t* data, size_t size) {
+      channel.send(data, size);
+      i++;
+    });
+  }
+}
+
+static void runParent(const char* name, Channel& channel, const Options& options) {
+  const std::string data(options.payload, 'x');
+  auto start = Clock::now();
+  for (int i = 0; i < options.frames; i++) {
+    channel.send(data.data(), data.size());
+  }
+  channel.recv([&](const uint8_t* p, size_t size) {
+    int count;
+    ASSERT(size == sizeof(count));
+    memcpy(&count, p, size);
+    ASSERT(count == options.frames);
+  });
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  PacketProcessor_LOG("%-10s throughput: %.2f Mframes/s, %.1f MB/s", name, options.frames / seconds / 1e6,
+                      (double)options.frames * options.payload / seconds / 1024 / 1024);
+
+  std::vector<double> rtt;
+  rtt.reserve(options.pings);
+  for (int i = 0; i < options.pings; i++) {
+    start = Clock::now();
+    channel.send(data.data(), data.size());
+    channel.recv([](const uint8_t*, size_t) {});
+    rtt.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+  }
+  std::sort(rtt.begin(), rtt.end());
+  PacketProcessor_LOG("%-10s round trip: p50 %.2f us, p99 %.2f us, max %.2f us", name, rtt[rtt.size() / 2], rtt[rtt.size() * 99 / 100],
+                      rtt.back());
+}
+
+static void benchShm(const Options& options) {
+  const std::string toChild = "/PacketProcessor_bench_a_" + std::to_string(getpid());
+  const std::string toParent = "/PacketProcessor_bench_b_" + std::to_string(getpid());
+  PacketShmRing out, in;
+  ASSERT(out.create(toChild, 1024 * 1024));
+  ASSERT(in.create(toParent, 1024 * 1024));
+
+  pid_t pid = fork();
+  ASSERT(pid >= 0);
+  if (pid == 0) {
+    // 子进程重新打开 与无关进程的使用方式相同
+    PacketShmRing childIn, childOut;
+    ASSERT(childIn.open(toChild));
+    ASSERT(childOut.open(toParent));
+    ShmChannel channel(&childOut, &childIn);
+    runChild(channel, options);
+    _exit(0);
+  }
+
+  ShmChannel channel(&out, &in);
+  runParent("shm ring", channel, options);
+  waitpid(pid, nullptr, 0);
+  PacketShmRing::unlink(toChild);
+  PacketShmRing::unlink(toParent);
+}
+
+static void benchSocket(const Options& options) {
+  int fds[2];
+  ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  pid_t pid = fork();
+  ASSERT(pid >= 0);
+  if (pid == 0) {
+    close(fds[0]);
+    SocketChannel channel(fds[1]);
+    runChild(channel, options);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  SocketChannel channel(fds[0]);
+  runParent("socketpair", channel, options);
+  waitpid(pid, nullptr, 0);
+  close(fds[0]);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (argc > 1) options.frames = atoi(argv[1]);
+  if (argc > 2) options.payload = atoi(argv[2]);
+  options.pings = std::max(1, std::min(options.frames / 10, 100000));
+  PacketProcessor_LOG("frames:%d, payload:%d, pings:%d", options.frames, options.payload, options.pings);
+
+  benchSocket(options);
+  benchShm(options);
+  return 0;
+}
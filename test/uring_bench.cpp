@@ -0,0 +1,180 @@
+/**
+ * 读取吞吐基准: 多个socketpair/管道 比较epoll+read与PacketUringReader
+ * 写入线程按轮询方式向每个fd写入已打包的数据 读取端解包并计数 统计从开始到解出全部数据包的耗时
+ * 用法: PacketProcessor_uring_bench [连接数] [每个连接的数据包数] [数据长度] [pipe]
+ */
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PacketProcessor.h"
+#include "PacketUringReader.h"
+#include "assert_def.h"
+#include "log.h"
+
+struct Options {
+  int connections = 64;
+  int frames = 20000;
+  int payload = 100;
+  bool pipe = false;
+};
+
+struct Endpoint {
+  int readFd;
+  int writeFd;
+  std::unique_ptr<PacketProcessor> processor;
+};
+
+static const int BATCH = 32;  // 每次写入的数据包数
+static size_t totalFrames;
+
+static std::vector<Endpoint> openEndpoints(const Options& options) {
+  std::vector<Endpoint> endpoints(options.connections);
+  for (auto& e : endpoints) {
+    int fds[2];
+    if (options.pipe) {
+      ASSERT(pipe(fds) == 0);
+    } else {
+      ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    }
+    e.readFd = fds[0];
+    e.writeFd = fds[1];
+    e.processor.reset(new PacketProcessor([](uint8_t*, size_t) {
+      totalFrames++;
+    }));
+  }
+  return endpoints;
+}
+
+static void closeEndpoints(std::vector<Endpoint>& endpoints) {
+  for (auto& e : endpoints) {
+    close(e.readFd);
+    close(e.writeFd);
+  }
+}
+
+/**
+ * 每次向每个fd写入一批数据包 阻塞写入
+ */
+static std::thread startWriter(const Options& options, const std::vector<Endpoint>& endpoints) {
+  std::string batch;
+  PacketProcessor packer;
+  for (int i = 0; i < BATCH; i++) {
+    batch += packer.pack(std::string(options.payload, (char)i));
+  }
+  std::vector<int> fds;
+  for (auto& e : endpoints) fds.push_back(e.writeFd);
+
+  return std::thread([fds, batch, options] {
+    for (int i = 0; i < options.frames; i += BATCH) {
+      for (int fd : fds) {
+        for (size_t sent = 0; sent < batch.size();) {
+          ssize_t n = write(fd, batch.data() + sent, batch.size() - sent);
+          ASSERT(n > 0);
+          sent += n;
+        }
+      }
+    }
+  });
+}
+
+static size_t expectFrames(const Options& options) {
+  return (size_t)((options.frames + BATCH - 1) / BATCH * BATCH) * options.connections;
+}
+
+static void report(const char* name, const Options& options, std::chrono::steady_clock::duration elapsed) {
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  const double bytes = (double)totalFrames * (options.payload + 10);
+  PacketProcessor_LOG("%-12s frames:%zu, %.2f s, %.2f Mframes/s, %.1f MB/s", name, totalFrames, seconds, totalFrames / seconds / 1e6,
+                      bytes / seconds / 1024 / 1024);
+}
+
+static void benchEpoll(const Options& options) {
+  auto endpoints = openEndpoints(options);
+  int epfd = epoll_create1(0);
+  ASSERT(epfd >= 0);
+  for (auto& e : endpoints) {
+    fcntl(e.readFd, F_SETFL, fcntl(e.readFd, F_GETFL) | O_NONBLOCK);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &e;
+    ASSERT(epoll_ctl(epfd, EPOLL_CTL_ADD, e.readFd, &ev) == 0);
+  }
+
+  totalFrames = 0;
+  const size_t expect = expectFrames(options);
+  const auto start = std::chrono::steady_clock::now();
+  auto writer = startWriter(options, endpoints);
+  std::vector<uint8_t> buffer(16 * 1024);
+  epoll_event events[64];
+  while (totalFrames < expect) {
+    int n = epoll_wait(epfd, events, 64, 100);
+    for (int i = 0; i < n; i++) {
+      auto e = (Endpoint*)events[i].data.ptr;
+      for (;;) {
+        ssize_t size = read(e->readFd, buffer.data(), buffer.size());
+        if (size <= 0) break;
+        e->processor->feed(buffer.data(), size);
+      }
+    }
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  writer.join();
+  report("epoll+read", options, elapsed);
+  close(epfd);
+  closeEndpoints(endpoints);
+}
+
+static void benchUring(const Options& options) {
+  auto endpoints = openEndpoints(options);
+  PacketUringReader reader(1024, 16 * 1024, 1024);
+  if (!reader.valid()) {
+    PacketProcessor_LOG("io_uring not supported, skip");
+    closeEndpoints(endpoints);
+    return;
+  }
+  for (auto& e : endpoints) {
+    ASSERT(reader.add(e.readFd, e.processor.get()));
+  }
+
+  totalFrames = 0;
+  const size_t expect = expectFrames(options);
+  const auto start = std::chrono::steady_clock::now();
+  auto writer = startWriter(options, endpoints);
+  while (totalFrames < expect) {
+    ASSERT(reader.poll(100) >= 0);
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  writer.join();
+  report("io_uring", options, elapsed);
+  PacketProcessor_LOG("io_uring     completions:%llu, submits:%llu, no buffers:%llu", (unsigned long long)reader.stats().completions,
+                      (unsigned long long)reader.stats().submits, (unsigned long long)reader.stats().noBuffers);
+  for (auto& e : endpoints) {
+    reader.remove(e.readFd);
+  }
+  closeEndpoints(endpoints);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (argc > 1) options.connections = atoi(argv[1]);
+  if (argc > 2) options.frames = atoi(argv[2]);
+  if (argc > 3) options.payload = atoi(argv[3]);
+  if (argc > 4) options.pipe = strcmp(argv[4], "pipe") == 0;
+  PacketProcessor_LOG("connections:%d, frames:%d, payload:%d, %s", options.connections, options.frames, options.payload,
+                      options.pipe ? "pipe" : "socketpair");
+
+  benchEpoll(options);
+  benchUring(options);
+  return 0;
+}